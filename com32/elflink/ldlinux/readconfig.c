@@ -30,6 +30,8 @@
 #include <core.h>
 #include <fs.h>
 #include <syslinux/pxe_api.h>
+#include <suffix_number.h>
+#include <cache.h>
 
 #include "menu.h"
 #include "config.h"
@@ -1419,6 +1421,12 @@ static void parse_config_file(FILE * f)
 	} else if (looking_at(p, "path")) {
 		if (parse_path(skipspace(p + 4)))
 			printf("Failed to parse PATH\n");
+	} else if (looking_at(p, "diskcache")) {
+		unsigned long long size;
+
+		size = suffix_number(skipspace(p + 9));
+		if (cache_set_size(min(size, 0xffffffffULL)))
+			printf("Failed to grow disk cache to %llu bytes\n", size);
 	} else if (looking_at(p, "sendcookies")) {
 		const union syslinux_derivative_info *sdi;
 
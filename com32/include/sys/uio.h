@@ -0,0 +1,19 @@
+/*
+ * sys/uio.h
+ */
+
+#ifndef _SYS_UIO_H
+#define _SYS_UIO_H
+
+#include <klibc/extern.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct iovec {
+    void *iov_base;		/* Start of the region */
+    size_t iov_len;		/* Length of the region */
+};
+
+__extern ssize_t preadv(int, const struct iovec *, int, off_t);
+
+#endif /* _SYS_UIO_H */
@@ -0,0 +1,57 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Permission is hereby granted, free of charge, to any person
+ *   obtaining a copy of this software and associated documentation
+ *   files (the "Software"), to deal in the Software without
+ *   restriction, including without limitation the rights to use,
+ *   copy, modify, merge, publish, distribute, sublicense, and/or
+ *   sell copies of the Software, and to permit persons to whom
+ *   the Software is furnished to do so, subject to the following
+ *   conditions:
+ *
+ *   The above copyright notice and this permission notice shall
+ *   be included in all copies or substantial portions of the Software.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *   OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ *   HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ *   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ *   OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * syslinux/cache.h
+ *
+ * The core's disk block cache, as seen by COM32 modules
+ */
+
+#ifndef _SYSLINUX_CACHE_H
+#define _SYSLINUX_CACHE_H
+
+#include <stdint.h>
+#include <klibc/compiler.h>
+
+/* Block cache statistics, as returned by cache_get_stats() */
+struct cache_stats {
+    uint32_t size;		/* Total cache memory in bytes */
+    uint32_t block_size;	/* Cache block size in bytes */
+    uint32_t entries;		/* Number of cache blocks */
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;		/* Misses which displaced a valid block */
+    uint32_t readahead;		/* Blocks brought in by read-ahead */
+};
+
+/*
+ * cache_set_size() grows the cache to at least size bytes; it does
+ * nothing if there is no block device (PXELINUX).  Both return -1 on
+ * failure.
+ */
+__extern int cache_set_size(uint32_t size);
+__extern int cache_get_stats(struct cache_stats *stats);
+
+#endif /* _SYSLINUX_CACHE_H */
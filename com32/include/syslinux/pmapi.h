@@ -37,6 +37,7 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <sys/types.h>
 
 /*
  * Note: add new members to this structure only at the end.
@@ -44,6 +45,7 @@
  */
 struct _DIR_;
 struct dirent;
+struct iovec;
 
 struct com32_filedata {
     size_t size;		/* File size */
@@ -77,6 +79,8 @@ struct com32_pmapi {
 
     const int sysappend_count;
     const char * const *sysappend_strings;
+
+    ssize_t (*preadv_file)(uint16_t, const struct iovec *, int, off_t);
 };
 
 #endif /* _SYSLINUX_PMAPI_H */
@@ -16,6 +16,7 @@ __extern int open(const char *, int, ...);
 __extern int close(int);
 
 __extern ssize_t read(int, void *, size_t);
+__extern ssize_t pread(int, void *, size_t, off_t);
 __extern ssize_t write(int, const void *, size_t);
 
 __extern int isatty(int);
@@ -0,0 +1,42 @@
+/*
+ * sys/pread.c
+ *
+ * Positional and scatter-gather reads.  These don't move the file
+ * position, so they can be freely mixed with read(); they are only
+ * supported for files on filesystems which can seek, and only while
+ * the file hasn't been read to EOF.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <com32.h>
+#include <pmapi.h>
+#include "file.h"
+
+ssize_t preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset)
+{
+    struct file_info *fp = &__file_info[fd];
+
+    if (fd >= NFILES || !fp->iop) {
+	errno = EBADF;
+	return -1;
+    }
+
+    if (fp->iop != &__file_dev) {
+	errno = ESPIPE;
+	return -1;
+    }
+
+    return pmapi_preadv_file(fp->i.fd.handle, iov, iovcnt, offset);
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+    struct iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len  = count;
+
+    return preadv(fd, &iov, 1, offset);
+}
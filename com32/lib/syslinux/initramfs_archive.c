@@ -31,16 +31,60 @@
  * Utility function to load an initramfs archive.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <syslinux/loadfile.h>
 #include <syslinux/linux.h>
 
+/*
+ * Load the archive into a buffer aligned the way the initramfs is
+ * placed in memory, so that if it is the only one, the Linux loader
+ * can hand it to the kernel where it is instead of copying it.
+ * The file is read straight into the buffer.
+ */
+static int load_aligned(const char *filename, void **ptr, size_t *len)
+{
+    struct stat st;
+    char *buf, *data;
+    FILE *f;
+
+    f = fopen(filename, "r");
+    if (!f)
+	return -1;
+
+    if (fstat(fileno(f), &st) || !S_ISREG(st.st_mode)) {
+	fclose(f);
+	return loadfile(filename, ptr, len);
+    }
+
+    buf = malloc(st.st_size + INITRAMFS_MAX_ALIGN - 1);
+    if (!buf)
+	goto err;
+
+    data = (char *)(((uintptr_t)buf + INITRAMFS_MAX_ALIGN - 1) &
+		    ~(uintptr_t)(INITRAMFS_MAX_ALIGN - 1));
+
+    if (fread(data, 1, st.st_size, f) != (size_t)st.st_size)
+	goto err;
+
+    fclose(f);
+    *ptr = data;
+    *len = st.st_size;
+    return 0;
+
+err:
+    free(buf);
+    fclose(f);
+    return -1;
+}
+
 int initramfs_load_archive(struct initramfs *ihead, const char *filename)
 {
     void *data;
     size_t len;
 
-    if (loadfile(filename, &data, &len))
+    if (load_aligned(filename, &data, &len))
 	return -1;
 
     return initramfs_add_data(ihead, data, len, len, 4);
@@ -124,6 +124,68 @@ static int map_initramfs(struct syslinux_movelist **fraglist,
     return 0;
 }
 
+/*
+ * Work out where the kernel will decompress itself, including its BSS
+ * and BRK, given that the protected-mode code was loaded at base.
+ * Only boot protocol 2.10 and later tell us: a relocatable kernel
+ * decompresses at base rounded up to kernel_alignment, but never below
+ * pref_address; any other kernel decompresses at pref_address.
+ * Returns false if the window cannot be determined.
+ */
+static bool decompress_window(const struct linux_header *hdr, addr_t base,
+			      addr_t *start, addr_t *end)
+{
+    addr_t addr = hdr->pref_address;
+
+    if (hdr->version < 0x020a || !(hdr->loadflags & LOAD_HIGH))
+	return false;
+
+    if (hdr->relocatable_kernel) {
+	addr_t align_mask = hdr->kernel_alignment ?
+	    hdr->kernel_alignment - 1 : 0;
+	addr_t aligned = (base + align_mask) & ~align_mask;
+
+	if (aligned > addr)
+	    addr = aligned;
+    }
+
+    *start = addr;
+    *end = addr + hdr->init_size;
+    return *end > *start;
+}
+
+/*
+ * If the initramfs is a single chunk which was loaded into a suitably
+ * aligned buffer in memory the kernel may use for it, return its
+ * address so it can be left where it is; the shuffle then has nothing
+ * to copy for it.  Returns 0 otherwise.
+ *
+ * amap only knows about the kernel image itself, not about the room
+ * the kernel needs to decompress itself and for its BSS and BRK, so
+ * the buffer must also stay clear of [win_start, win_end).
+ */
+static addr_t initramfs_in_place(struct initramfs *initramfs,
+				 struct syslinux_memmap *amap, addr_t irf_size,
+				 addr_t win_start, addr_t win_end)
+{
+    struct initramfs *ip = initramfs->next;
+    addr_t addr = (addr_t)(uintptr_t)ip->data;
+
+    if (!ip->len || ip->next->len || ip->data_len != ip->len)
+	return 0;
+
+    if (addr & (INITRAMFS_MAX_ALIGN - 1))
+	return 0;
+
+    if (addr < win_end && addr + irf_size > win_start)
+	return 0;
+
+    if (syslinux_memmap_type(amap, addr, irf_size) != SMT_FREE)
+	return 0;
+
+    return addr;
+}
+
 static size_t calc_cmdline_offset(const struct syslinux_memmap *mmap,
 				  const struct linux_header *hdr,
 				  size_t cmdline_size, addr_t base,
@@ -389,13 +451,21 @@ int bios_boot_linux(void *kernel_buf, size_t kernel_size,
 	addr_t best_addr = 0;
 	struct syslinux_memmap *ml;
 	const addr_t align_mask = INITRAMFS_MAX_ALIGN - 1;
+	addr_t win_start, win_end;
 
 	if (irf_size) {
-	    for (ml = amap; ml->type != SMT_END; ml = ml->next) {
-		addr_t adj_start = (ml->start + align_mask) & ~align_mask;
-		addr_t adj_end = ml->next->start & ~align_mask;
-		if (ml->type == SMT_FREE && adj_end - adj_start >= irf_size)
-		    best_addr = (adj_end - irf_size) & ~align_mask;
+	    if (decompress_window(&hdr, prot_mode_base,
+				  &win_start, &win_end))
+		best_addr = initramfs_in_place(initramfs, amap, irf_size,
+					       win_start, win_end);
+
+	    if (!best_addr) {
+		for (ml = amap; ml->type != SMT_END; ml = ml->next) {
+		    addr_t adj_start = (ml->start + align_mask) & ~align_mask;
+		    addr_t adj_end = ml->next->start & ~align_mask;
+		    if (ml->type == SMT_FREE && adj_end - adj_start >= irf_size)
+			best_addr = (adj_end - irf_size) & ~align_mask;
+		}
 	    }
 
 	    if (!best_addr) {
@@ -34,8 +34,7 @@ int syslinux_shuffle_boot_rm(struct syslinux_movelist *fraglist,
 
     __test_called_boot_rm = true;
 
-    ml = fraglist;
-    while (ml) {
+    for (ml = fraglist; ml; ml = ml->next) {
 	addr_t cmdline_addr, last_lowmem_addr;
 
 	if (ml->src != __test_cmdline)
@@ -190,10 +189,91 @@ static int test_terminal_regions(void)
     return 0;
 }
 
+static addr_t __test_in_place(struct syslinux_memmap *amap,
+			      const struct linux_header *hdr, addr_t base,
+			      addr_t addr, addr_t size)
+{
+    struct initramfs head, irf;
+    addr_t win_start, win_end;
+
+    memset(&head, 0, sizeof head);
+    memset(&irf, 0, sizeof irf);
+    head.next = head.prev = &irf;
+    irf.next = irf.prev = &head;
+    irf.len = irf.data_len = size;
+    irf.data = (const void *)(uintptr_t)addr;
+
+    if (!decompress_window(hdr, base, &win_start, &win_end))
+	return 0;
+
+    return initramfs_in_place(&head, amap, size, win_start, win_end);
+}
+
+/*
+ * An initramfs may only be left where it was loaded if it stays clear
+ * of the region the kernel decompresses into, which for a relocatable
+ * kernel depends on where it was loaded.
+ */
+static int test_initramfs_in_place(void)
+{
+    struct syslinux_memmap *amap;
+    struct linux_header hdr;
+    addr_t addr;
+
+    struct test_memmap_entry entries[] = {
+	0x00000000, 0x00090000, SMT_FREE,
+	0x00100000, 0x3ff00000, SMT_FREE,
+    };
+
+    amap = test_build_mmap(entries, array_sz(entries));
+    if (!amap)
+	return -1;
+
+    memset(&hdr, 0, sizeof hdr);
+    hdr.version = 0x020a;
+    hdr.loadflags = LOAD_HIGH;
+    hdr.relocatable_kernel = 1;
+    hdr.kernel_alignment = 0x200000;
+    hdr.pref_address = 0x1000000;
+    hdr.init_size = 0x1000000;
+
+    /* Loaded at 1 MB, so the kernel decompresses at pref_address */
+    addr = __test_in_place(amap, &hdr, 0x100000, 0x3000000, 0x100000);
+    syslinux_assert_str(addr == 0x3000000,
+			"initramfs above the window not kept in place");
+
+    addr = __test_in_place(amap, &hdr, 0x100000, 0x1800000, 0x100000);
+    syslinux_assert_str(addr == 0,
+			"initramfs inside the window kept in place");
+
+    addr = __test_in_place(amap, &hdr, 0x100000, 0xff0000, 0x20000);
+    syslinux_assert_str(addr == 0,
+			"initramfs overlapping the window kept in place");
+
+    /* Loaded high, the window moves up to the aligned load address */
+    addr = __test_in_place(amap, &hdr, 0x3100000, 0x3000000, 0x100000);
+    syslinux_assert_str(addr == 0x3000000,
+			"initramfs below the window not kept in place");
+
+    addr = __test_in_place(amap, &hdr, 0x3100000, 0x4000000, 0x100000);
+    syslinux_assert_str(addr == 0,
+			"initramfs inside the moved window kept in place");
+
+    /* Without init_size the window is unknown */
+    hdr.version = 0x0209;
+    addr = __test_in_place(amap, &hdr, 0x100000, 0x3000000, 0x100000);
+    syslinux_assert_str(addr == 0,
+			"initramfs kept in place for an old kernel");
+
+    syslinux_free_memmap(amap);
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     test_cmdline_placement();
     test_terminal_regions();
+    test_initramfs_in_place();
 
     return 0;
 }
@@ -28,12 +28,24 @@ union tree_buf {
 	struct btrfs_leaf leaf;
 };
 
+/* number of tree nodes kept decoded in memory */
+#define BTRFS_NODE_CACHE 16
+
+struct btrfs_node_cache {
+	u64 bytenr;		/* logical address, 0 if unused */
+	u32 stamp;		/* last use, for LRU replacement */
+	union tree_buf *buf;
+};
+
 /* filesystem instance structure */
 struct btrfs_info {
 	u64 fs_tree;
 	struct btrfs_super_block sb;
 	struct btrfs_chunk_map chunk_map;
-	union tree_buf *tree_buf;
+	u32 last_chunk;		/* chunk map slot of the last lookup */
+	u32 node_size;
+	u32 node_clock;
+	struct btrfs_node_cache nodes[BTRFS_NODE_CACHE];
 };
 
 /* compare function used for bin_search */
@@ -80,9 +92,9 @@ static int btrfs_comp_chunk_map(struct btrfs_chunk_map_item *m1,
 	return 0;
 }
 
-/* insert a new chunk mapping item */
-static void insert_chunk_item(struct fs_info *fs,
-			      struct btrfs_chunk_map_item *item)
+/* insert a new chunk mapping item, return 0 if it was inserted */
+static int insert_chunk_item(struct fs_info *fs,
+			     struct btrfs_chunk_map_item *item)
 {
 	struct btrfs_info * const bfs = fs->fs_info;
 	struct btrfs_chunk_map *chunk_map = &bfs->chunk_map;
@@ -96,51 +108,127 @@ static void insert_chunk_item(struct fs_info *fs,
 					* sizeof(chunk_map->map[0]));
 		chunk_map->map[0] = *item;
 		chunk_map->cur_length = 1;
-		return;
+		return 0;
 	}
 	ret = bin_search(chunk_map->map, sizeof(*item), item,
 			(cmp_func)btrfs_comp_chunk_map, 0,
 			chunk_map->cur_length, &slot);
 	if (ret == 0)/* already in map */
-		return;
+		return 1;
 	if (chunk_map->cur_length == BTRFS_MAX_CHUNK_ENTRIES) {
 		/* should be impossible */
 		printf("too many chunk items\n");
-		return;
+		return 1;
 	}
 	for (i = chunk_map->cur_length; i > slot; i--)
 		chunk_map->map[i] = chunk_map->map[i-1];
 	chunk_map->map[slot] = *item;
 	chunk_map->cur_length++;
+	return 0;
 }
 
+/*
+ * Record where each stripe of a chunk lives.  We can only read the
+ * device we booted from, so stripes on other devices are marked
+ * missing; as long as every piece of data has a copy on this device
+ * (single, DUP, and RAID1 or RAID10 mirrors) the filesystem reads fine.
+ */
 static inline void insert_map(struct fs_info *fs, struct btrfs_disk_key *key,
 			      struct btrfs_chunk *chunk)
 {
+	struct btrfs_info * const bfs = fs->fs_info;
 	struct btrfs_stripe *stripe = &chunk->stripe;
-	struct btrfs_stripe *stripe_end = stripe + chunk->num_stripes;
 	struct btrfs_chunk_map_item item;
+	int i;
 
 	item.logical = key->offset;
 	item.length = chunk->length;
-	for ( ; stripe < stripe_end; stripe++) {
-		item.devid = stripe->devid;
-		item.physical = stripe->offset;
-		insert_chunk_item(fs, &item);
+	item.type = chunk->type;
+	item.stripe_len = chunk->stripe_len;
+	item.num_stripes = chunk->num_stripes;
+	item.sub_stripes = chunk->sub_stripes;
+	item.physical = malloc(chunk->num_stripes * sizeof(u64));
+	if (!item.physical || !item.num_stripes || !item.stripe_len) {
+		free(item.physical);
+		return;
+	}
+	for (i = 0; i < chunk->num_stripes; i++) {
+		if (stripe[i].devid == bfs->sb.dev_item.devid)
+			item.physical[i] = stripe[i].offset;
+		else
+			item.physical[i] = BTRFS_STRIPE_MISSING;
+	}
+	if (insert_chunk_item(fs, &item))
+		free(item.physical);
+}
+
+/*
+ * Map an offset into a chunk to the physical address on the boot
+ * device, following the chunk's RAID profile.  *len is set to the
+ * number of bytes that are contiguous from there.
+ */
+static u64 map_stripe(const struct btrfs_chunk_map_item *map, u64 offset,
+		      u64 *len)
+{
+	u64 stripe_nr, stripe_offset;
+	u32 index, copies, factor, i;
+
+	*len = map->length - offset;
+	if (map->type & (BTRFS_BLOCK_GROUP_RAID0 | BTRFS_BLOCK_GROUP_RAID10)) {
+		stripe_nr = offset / map->stripe_len;
+		stripe_offset = offset - stripe_nr * map->stripe_len;
+		if (map->type & BTRFS_BLOCK_GROUP_RAID10) {
+			copies = map->sub_stripes ? map->sub_stripes : 1;
+			factor = map->num_stripes / copies;
+		} else {
+			copies = 1;
+			factor = map->num_stripes;
+		}
+		if (!factor)
+			return BTRFS_STRIPE_MISSING;
+		index = (stripe_nr % factor) * copies;
+		stripe_nr /= factor;
+		offset = stripe_nr * map->stripe_len + stripe_offset;
+		*len = map->stripe_len - stripe_offset;
+	} else if (map->type & (BTRFS_BLOCK_GROUP_RAID5 |
+				BTRFS_BLOCK_GROUP_RAID6)) {
+		/* parity RAID always needs the other devices */
+		return BTRFS_STRIPE_MISSING;
+	} else {
+		/* single, DUP and RAID1*: every stripe is a full copy */
+		index = 0;
+		copies = map->num_stripes;
+	}
+
+	/* any copy that is on this device will do */
+	for (i = index; i < index + copies && i < map->num_stripes; i++) {
+		if (map->physical[i] != BTRFS_STRIPE_MISSING)
+			return map->physical[i] + offset;
 	}
+	return BTRFS_STRIPE_MISSING;
 }
 
 /*
  * from sys_chunk_array or chunk_tree, we can convert a logical address to
- * a physical address we can not support multi device case yet
+ * a physical address on the boot device, and find how many bytes from
+ * there are contiguous on disk
  */
-static u64 logical_physical(struct fs_info *fs, u64 logical)
+static u64 logical_physical_len(struct fs_info *fs, u64 logical, u64 *len)
 {
 	struct btrfs_info * const bfs = fs->fs_info;
 	struct btrfs_chunk_map *chunk_map = &bfs->chunk_map;
+	struct btrfs_chunk_map_item *map;
 	struct btrfs_chunk_map_item item;
 	int slot, ret;
 
+	/* consecutive lookups are mostly in the same chunk */
+	if (bfs->last_chunk < chunk_map->cur_length) {
+		map = &chunk_map->map[bfs->last_chunk];
+		if (logical >= map->logical &&
+		    logical < map->logical + map->length)
+			return map_stripe(map, logical - map->logical, len);
+	}
+
 	item.logical = logical;
 	ret = bin_search(chunk_map->map, sizeof(chunk_map->map[0]), &item,
 			(cmp_func)btrfs_comp_chunk_map, 0,
@@ -149,11 +237,42 @@ static u64 logical_physical(struct fs_info *fs, u64 logical)
 		slot++;
 	else if (slot == 0)
 		return -1;
-	if (logical >=
-		chunk_map->map[slot-1].logical + chunk_map->map[slot-1].length)
+	map = &chunk_map->map[slot-1];
+	if (logical >= map->logical + map->length)
 		return -1;
-	return chunk_map->map[slot-1].physical + logical -
-			chunk_map->map[slot-1].logical;
+	bfs->last_chunk = slot - 1;
+	return map_stripe(map, logical - map->logical, len);
+}
+
+static inline u64 logical_physical(struct fs_info *fs, u64 logical)
+{
+	u64 len;
+
+	return logical_physical_len(fs, logical, &len);
+}
+
+/*
+ * Read len bytes at a logical address through the block cache; they
+ * may be spread over several stripes.  Returns 0 on success.
+ */
+int btrfs_read_logical(struct fs_info *fs, void *buf, u64 logical, u32 len)
+{
+	u64 physical, contig;
+	u32 n;
+
+	while (len) {
+		physical = logical_physical_len(fs, logical, &contig);
+		if (physical == BTRFS_STRIPE_MISSING) {
+			printf("btrfs: %llu is not on this device\n", logical);
+			return -1;
+		}
+		n = min((u64)len, contig);
+		cache_read(fs, buf, physical, n);
+		buf += n;
+		logical += n;
+		len -= n;
+	}
+	return 0;
 }
 
 /* btrfs has several super block mirrors, need to calculate their location */
@@ -249,54 +368,109 @@ static int btrfs_comp_keys_type(const struct btrfs_disk_key *k1,
 	return 0;
 }
 
-/* seach tree directly on disk ... */
+/*
+ * Return tree node or leaf at logical address bytenr.  The most recently
+ * used nodes are kept, so walks from the root mostly stay in memory; the
+ * buffer is only valid until the next call.  Returns NULL if the node
+ * can't be read.
+ */
+static union tree_buf *btrfs_read_node(struct fs_info *fs, u64 bytenr)
+{
+	struct btrfs_info * const bfs = fs->fs_info;
+	struct btrfs_node_cache *nc, *victim = NULL;
+	u64 physical;
+
+	for (nc = bfs->nodes; nc < &bfs->nodes[BTRFS_NODE_CACHE]; nc++) {
+		if (nc->bytenr == bytenr && nc->buf) {
+			nc->stamp = ++bfs->node_clock;
+			return nc->buf;
+		}
+		if (!victim || nc->stamp < victim->stamp)
+			victim = nc;
+	}
+
+	if (!victim->buf) {
+		victim->buf = malloc(bfs->node_size);
+		if (!victim->buf) {
+			/* out of memory: recycle the oldest allocated node */
+			victim = NULL;
+			for (nc = bfs->nodes;
+			     nc < &bfs->nodes[BTRFS_NODE_CACHE]; nc++)
+				if (nc->buf && (!victim ||
+						nc->stamp < victim->stamp))
+					victim = nc;
+			if (!victim)
+				return NULL;
+		}
+	}
+
+	physical = logical_physical(fs, bytenr);
+	if (physical == BTRFS_STRIPE_MISSING) {
+		printf("btrfs: tree block %llu is not on this device\n",
+		       bytenr);
+		return NULL;
+	}
+
+	/* the buffer is no longer what it held before */
+	victim->bytenr = 0;
+	if (cache_read(fs, victim->buf, physical, bfs->node_size) !=
+	    bfs->node_size) {
+		printf("btrfs: can't read tree block %llu\n", bytenr);
+		return NULL;
+	}
+	victim->bytenr = bytenr;
+	victim->stamp = ++bfs->node_clock;
+	return victim->buf;
+}
+
+/*
+ * seach tree from the node at loffset down to a leaf; returns -1, with
+ * path->item cleared, if a node on the way can't be read
+ */
 static int search_tree(struct fs_info *fs, u64 loffset,
 		       struct btrfs_disk_key *key, struct btrfs_path *path)
 {
-	struct btrfs_info * const bfs = fs->fs_info;
-	union tree_buf *tree_buf = bfs->tree_buf;
+	union tree_buf *tree_buf = btrfs_read_node(fs, loffset);
+	struct btrfs_item *item;
+	int level;
 	int slot, ret;
-	u64 offset;
 
-	offset = logical_physical(fs, loffset);
-	cache_read(fs, &tree_buf->header, offset, sizeof(tree_buf->header));
-	if (tree_buf->header.level) {
+	if (!tree_buf) {
+		memset(&path->item, 0, sizeof path->item);
+		return -1;
+	}
+
+	level = tree_buf->header.level;
+
+	path->itemsnr[level] = tree_buf->header.nritems;
+	path->offsets[level] = loffset;
+	if (level) {
 		/* inner node */
-		cache_read(fs, (char *)&tree_buf->node.ptrs[0],
-			   offset + sizeof tree_buf->header,
-			   bfs->sb.nodesize - sizeof tree_buf->header);
-		path->itemsnr[tree_buf->header.level] = tree_buf->header.nritems;
-		path->offsets[tree_buf->header.level] = loffset;
 		ret = bin_search(&tree_buf->node.ptrs[0],
 				 sizeof(struct btrfs_key_ptr),
 				 key, (cmp_func)btrfs_comp_keys,
-				 path->slots[tree_buf->header.level],
+				 path->slots[level],
 				 tree_buf->header.nritems, &slot);
-		if (ret && slot > path->slots[tree_buf->header.level])
+		if (ret && slot > path->slots[level])
 			slot--;
-		path->slots[tree_buf->header.level] = slot;
+		path->slots[level] = slot;
 		ret = search_tree(fs, tree_buf->node.ptrs[slot].blockptr,
 				  key, path);
 	} else {
 		/* leaf node */
-		cache_read(fs, (char *)&tree_buf->leaf.items[0],
-			   offset + sizeof tree_buf->header,
-			   bfs->sb.leafsize - sizeof tree_buf->header);
-		path->itemsnr[tree_buf->header.level] = tree_buf->header.nritems;
-		path->offsets[tree_buf->header.level] = loffset;
 		ret = bin_search(&tree_buf->leaf.items[0],
 				 sizeof(struct btrfs_item),
 				 key, (cmp_func)btrfs_comp_keys,
 				 path->slots[0],
 				 tree_buf->header.nritems, &slot);
-		if (ret && slot > path->slots[tree_buf->header.level])
+		if (ret && slot > path->slots[0])
 			slot--;
-		path->slots[tree_buf->header.level] = slot;
-		path->item = tree_buf->leaf.items[slot];
-		cache_read(fs, (char *)&path->data,
-			   offset + sizeof tree_buf->header +
-			   tree_buf->leaf.items[slot].offset,
-			   tree_buf->leaf.items[slot].size);
+		path->slots[0] = slot;
+		item = &tree_buf->leaf.items[slot];
+		path->item = *item;
+		memcpy(path->data,
+		       (char *)tree_buf + sizeof(struct btrfs_header) +
+		       item->offset, min(item->size, (u32)sizeof path->data));
 	}
 	return ret;
 }
@@ -317,7 +491,8 @@ static int next_leaf(struct fs_info *fs, struct btrfs_disk_key *key, struct btrf
 		}
 		path->slots[level] = slot;
 		path->slots[level-1] = 0; /* reset low level slots info */
-		search_tree(fs, path->offsets[level], key, path);
+		if (search_tree(fs, path->offsets[level], key, path) < 0)
+			return 1;
 		break;
 	}
 	if (level == BTRFS_MAX_LEVEL)
@@ -337,7 +512,8 @@ static int next_slot(struct fs_info *fs, struct btrfs_disk_key *key,
 	if (slot >= path->itemsnr[0])
 		return 1;
 	path->slots[0] = slot;
-	search_tree(fs, path->offsets[0], key, path);
+	if (search_tree(fs, path->offsets[0], key, path) < 0)
+		return 1;
 	return 0;
 }
 
@@ -373,7 +549,8 @@ static void btrfs_read_chunk_tree(struct fs_info *fs)
 
 	if (!(bfs->sb.flags & BTRFS_SUPER_FLAG_METADUMP)) {
 		if (bfs->sb.num_devices > 1)
-			printf("warning: only support single device btrfs\n");
+			dprintf("btrfs: %llu devices, reading devid %llu\n",
+				bfs->sb.num_devices, bfs->sb.dev_item.devid);
 
 		ignore_key.objectid = BTRFS_DEV_ITEMS_OBJECTID;
 		ignore_key.type = BTRFS_DEV_ITEM_KEY;
@@ -435,26 +612,6 @@ static struct inode *btrfs_iget_by_inr(struct fs_info *fs, u64 inr)
 	inode->size = inode_item.size;
 	inode->mode = IFTODT(inode_item.mode);
 
-	if (inode->mode == DT_REG || inode->mode == DT_LNK) {
-		struct btrfs_file_extent_item extent_item;
-		u64 offset;
-
-		/* get file_extent_item */
-		search_key.type = BTRFS_EXTENT_DATA_KEY;
-		search_key.offset = 0;
-		clear_path(&path);
-		ret = search_tree(fs, bfs->fs_tree, &search_key, &path);
-		if (ret)
-			return NULL; /* impossible */
-		extent_item = *(struct btrfs_file_extent_item *)path.data;
-		if (extent_item.type == BTRFS_FILE_EXTENT_INLINE)/* inline file */
-			offset = path.offsets[0] + sizeof(struct btrfs_header)
-				+ path.item.offset
-				+ offsetof(struct btrfs_file_extent_item, disk_bytenr);
-		else
-			offset = extent_item.disk_bytenr;
-		PVT(inode)->offset = offset;
-	}
 	return inode;
 }
 
@@ -485,15 +642,6 @@ static struct inode *btrfs_iget(const char *name, struct inode *parent)
 	return btrfs_iget_by_inr(fs, dir_item.location.objectid);
 }
 
-static int btrfs_readlink(struct inode *inode, char *buf)
-{
-	cache_read(inode->fs, buf,
-		   logical_physical(inode->fs, PVT(inode)->offset),
-		   inode->size);
-	buf[inode->size] = '\0';
-	return inode->size;
-}
-
 static int btrfs_readdir(struct file *file, struct dirent *dirent)
 {
 	struct fs_info * const fs = file->fs;
@@ -533,76 +681,225 @@ static int btrfs_readdir(struct file *file, struct dirent *dirent)
 	return 0;
 }
 
-static int btrfs_next_extent(struct inode *inode, uint32_t lstart)
+/*
+ * Decode the item in the given slot of the leaf at bytenr into
+ * PVT(inode)->extent, and remember where it was.  Returns 1 if that is
+ * not a file extent item of the inode, -1 if it can't be read.
+ */
+static int btrfs_decode_extent(struct inode *inode, u64 bytenr, int slot)
 {
+	struct fs_info * const fs = inode->fs;
+	struct btrfs_extent * const extent = &PVT(inode)->extent;
+	union tree_buf *leaf = btrfs_read_node(fs, bytenr);
+	struct btrfs_file_extent_item *fi;
+	struct btrfs_item *item;
+	u32 data;
+
+	if (!leaf)
+		return -1;
+	if (leaf->header.level || slot < 0 || slot >= leaf->header.nritems)
+		return 1;
+	item = &leaf->leaf.items[slot];
+	if (item->key.objectid != inode->ino ||
+	    item->key.type != BTRFS_EXTENT_DATA_KEY)
+		return 1;
+
+	data = sizeof(struct btrfs_header) + item->offset;
+	fi = (struct btrfs_file_extent_item *)((char *)leaf + data);
+	if (fi->encryption || fi->other_encoding) {
+		printf("btrfs: found encrypted data, cannot continue!\n");
+		return -1;
+	}
+
+	extent->start = item->key.offset;
+	extent->type = fi->type;
+	extent->compression = fi->compression;
+	if (fi->type == BTRFS_FILE_EXTENT_INLINE) {
+		/* the data follows the item header in the leaf */
+		extent->end = extent->start + fi->ram_bytes;
+		extent->bytenr = bytenr + data +
+			offsetof(struct btrfs_file_extent_item, disk_bytenr);
+		extent->disk_bytes = item->size -
+			offsetof(struct btrfs_file_extent_item, disk_bytenr);
+		extent->offset = 0;
+	} else {
+		extent->end = extent->start + fi->num_bytes;
+		extent->bytenr = 0;
+		if (fi->type == BTRFS_FILE_EXTENT_REG)
+			extent->bytenr = fi->disk_bytenr;
+		extent->disk_bytes = fi->disk_num_bytes;
+		extent->offset = fi->offset;
+	}
+
+	PVT(inode)->leaf = bytenr;
+	PVT(inode)->slot = slot;
+	return 0;
+}
+
+/*
+ * Find the file extent covering byte pos of the inode and decode it
+ * into PVT(inode)->extent.  The last extent found is kept, and reading
+ * on from it first tries the next item in the same leaf, so reading a
+ * file sequentially only searches the tree when it crosses a leaf.
+ * Ranges without an extent item (no-holes filesystems) are returned as
+ * a hole.
+ */
+static int btrfs_get_extent(struct inode *inode, u64 pos)
+{
+	struct fs_info * const fs = inode->fs;
+	struct btrfs_info * const bfs = fs->fs_info;
+	struct btrfs_extent * const extent = &PVT(inode)->extent;
 	struct btrfs_disk_key search_key;
-	struct btrfs_file_extent_item extent_item;
 	struct btrfs_path path;
 	int ret;
-	u64 offset;
-	struct fs_info * const fs = inode->fs;
-	struct btrfs_info * const bfs = fs->fs_info;
-	u32 sec_shift = SECTOR_SHIFT(fs);
-	u32 sec_size = SECTOR_SIZE(fs);
+
+	if (pos >= extent->start && pos < extent->end)
+		return 0;
+
+	if (PVT(inode)->leaf && pos >= extent->end) {
+		ret = btrfs_decode_extent(inode, PVT(inode)->leaf,
+					  PVT(inode)->slot + 1);
+		if (ret < 0)
+			return -1;
+		if (!ret && pos >= extent->start && pos < extent->end)
+			return 0;
+	}
 
 	search_key.objectid = inode->ino;
 	search_key.type = BTRFS_EXTENT_DATA_KEY;
-	search_key.offset = lstart << sec_shift;
+	search_key.offset = pos;
 	clear_path(&path);
 	ret = search_tree(fs, bfs->fs_tree, &search_key, &path);
-	if (ret) { /* impossible */
-		printf("btrfs: search extent data error!\n");
+	if (ret < 0)
+		return -1;
+
+	if (!btrfs_comp_keys_type(&search_key, &path.item.key) &&
+	    path.item.key.offset <= pos) {
+		if (btrfs_decode_extent(inode, path.offsets[0],
+					path.slots[0]) < 0)
+			return -1;
+		if (pos < extent->end)
+			return 0;
+		ret = 1;
+	}
+
+	/* a hole, up to the next extent item if there is one */
+	extent->start = pos;
+	extent->end = -1ULL;
+	extent->bytenr = 0;
+	extent->type = BTRFS_FILE_EXTENT_REG;
+	extent->compression = BTRFS_COMPRESS_NONE;
+	if (!ret || btrfs_comp_keys(&search_key, &path.item.key) > 0) {
+		if (next_slot(fs, &search_key, &path) &&
+		    next_leaf(fs, &search_key, &path))
+			return 0;
+	}
+	if (!btrfs_comp_keys_type(&search_key, &path.item.key) &&
+	    path.item.key.offset > pos)
+		extent->end = path.item.key.offset;
+
+	/* the item after the hole is the next one to try */
+	PVT(inode)->leaf = path.offsets[0];
+	PVT(inode)->slot = path.slots[0] - 1;
+	return 0;
+}
+
+/*
+ * Read up to len bytes at file offset pos, without crossing the end of
+ * the extent containing pos.  Returns the number of bytes read, or -1.
+ */
+static int btrfs_read_data(struct inode *inode, u64 pos, char *buf, u32 len)
+{
+	struct fs_info * const fs = inode->fs;
+	struct disk * const disk = fs->fs_dev->disk;
+	const struct btrfs_extent *extent;
+	u32 sec_mask = SECTOR_SIZE(fs) - 1;
+	u64 logical, physical, contig;
+	u32 done, n, bulk;
+
+	if (btrfs_get_extent(inode, pos))
 		return -1;
+	extent = &PVT(inode)->extent;
+	len = min((u64)len, extent->end - pos);
+
+	if (extent->compression) {
+		if (btrfs_decompress(fs, &PVT(inode)->decomp, extent,
+				     extent->offset + pos - extent->start,
+				     buf, len))
+			return -1;
+		return len;
 	}
-	extent_item = *(struct btrfs_file_extent_item *)path.data;
 
-	if (extent_item.encryption) {
-	    printf("btrfs: found encrypted data, cannot continue!\n");
-	    return -1;
+	if (!extent->bytenr) {
+		memset(buf, 0, len);
+		return len;
 	}
-	if (extent_item.compression) {
-	    printf("btrfs: found compressed data, cannot continue!\n");
-	    return -1;
+
+	logical = extent->bytenr + extent->offset + pos - extent->start;
+	for (done = 0; done < len; done += n) {
+		physical = logical_physical_len(fs, logical + done, &contig);
+		if (physical == BTRFS_STRIPE_MISSING) {
+			printf("btrfs: file data is not on this device\n");
+			return done ? (int)done : -1;
+		}
+		n = min((u64)(len - done), contig);
+		/* whole sectors straight from the disk, the rest cached */
+		bulk = (physical & sec_mask) ? 0 : n & ~sec_mask;
+		if (bulk)
+			disk->rdwr_sectors(disk, buf + done,
+					   physical >> SECTOR_SHIFT(fs),
+					   bulk >> SECTOR_SHIFT(fs), 0);
+		if (n > bulk)
+			cache_read(fs, buf + done + bulk, physical + bulk,
+				   n - bulk);
 	}
+	return len;
+}
 
-	if (extent_item.type == BTRFS_FILE_EXTENT_INLINE) {/* inline file */
-		/* we fake a extent here, and PVT of inode will tell us */
-		offset = path.offsets[0] + sizeof(struct btrfs_header)
-			+ path.item.offset
-			+ offsetof(struct btrfs_file_extent_item, disk_bytenr);
-		inode->next_extent.len =
-			(inode->size + sec_size -1) >> sec_shift;
-	} else {
-		offset = extent_item.disk_bytenr + extent_item.offset;
-		inode->next_extent.len =
-			(extent_item.num_bytes + sec_size - 1) >> sec_shift;
+static int btrfs_readlink(struct inode *inode, char *buf)
+{
+	u32 done = 0;
+	int ret;
+
+	while (done < inode->size) {
+		ret = btrfs_read_data(inode, done, buf + done,
+				      inode->size - done);
+		if (ret <= 0)
+			return -1;
+		done += ret;
 	}
-	inode->next_extent.pstart = logical_physical(fs, offset) >> sec_shift;
-	PVT(inode)->offset = offset;
-	return 0;
+	buf[inode->size] = '\0';
+	return inode->size;
 }
 
 static uint32_t btrfs_getfssec(struct file *file, char *buf, int sectors,
-					bool *have_more)
+			       bool *have_more)
 {
-	u32 ret;
-	struct fs_info *fs = file->fs;
-	u32 off = PVT(file->inode)->offset % SECTOR_SIZE(fs);
-	bool handle_inline = false;
+	struct inode * const inode = file->inode;
+	struct fs_info * const fs = file->fs;
+	u32 bytes_left = inode->size - file->offset;
+	u32 len = min((u32)sectors << SECTOR_SHIFT(fs), bytes_left);
+	u32 done = 0;
+	int ret;
 
-	if (off && !file->offset) {/* inline file first read patch */
-		file->inode->size += off;
-		handle_inline = true;
-	}
-	ret = generic_getfssec(file, buf, sectors, have_more);
-	if (!ret)
-		return ret;
-	off = PVT(file->inode)->offset % SECTOR_SIZE(fs);
-	if (handle_inline) {/* inline file patch */
-		ret -= off;
-		memcpy(buf, buf + off, ret);
+	while (done < len) {
+		ret = btrfs_read_data(inode, file->offset + done, buf + done,
+				      len - done);
+		if (ret <= 0)
+			break;
+		done += ret;
 	}
-	return ret;
+	file->offset += done;
+
+	if (have_more)
+		*have_more = done < bytes_left;
+
+	return done;
+}
+
+static void btrfs_free_inode(struct inode *inode)
+{
+	btrfs_decomp_free(PVT(inode)->decomp);
 }
 
 static void btrfs_get_fs_tree(struct fs_info *fs)
@@ -653,7 +950,10 @@ static void btrfs_get_fs_tree(struct fs_info *fs)
 	search_key.type = BTRFS_ROOT_ITEM_KEY;
 	search_key.offset = -1;
 	clear_path(&path);
-	search_tree(fs, bfs->sb.root, &search_key, &path);
+	if (search_tree(fs, bfs->sb.root, &search_key, &path) < 0) {
+		printf("btrfs: can't read the root tree\n");
+		return;
+	}
 	tree = (struct btrfs_root_item *)path.data;
 	bfs->fs_tree = tree->bytenr;
 }
@@ -683,8 +983,10 @@ static int btrfs_fs_init(struct fs_info *fs)
 	btrfs_read_super_block(fs);
 	if (bfs->sb.magic != BTRFS_MAGIC_N)
 		return -1;
-	bfs->tree_buf = malloc(max(bfs->sb.nodesize, bfs->sb.leafsize));
-	if (!bfs->tree_buf)
+	bfs->node_size = max(bfs->sb.nodesize, bfs->sb.leafsize);
+	/* the node cache always has at least one buffer to recycle */
+	bfs->nodes[0].buf = malloc(bfs->node_size);
+	if (!bfs->nodes[0].buf)
 		return -1;
 	btrfs_read_sys_chunk_array(fs);
 	btrfs_read_chunk_tree(fs);
@@ -695,15 +997,15 @@ static int btrfs_fs_init(struct fs_info *fs)
 
 const struct fs_ops btrfs_fs_ops = {
     .fs_name       = "btrfs",
-    .fs_flags      = 0,
+    .fs_flags      = FS_SEEKABLE,
     .fs_init       = btrfs_fs_init,
     .iget_root     = btrfs_iget_root,
     .iget          = btrfs_iget,
+    .free_inode    = btrfs_free_inode,
     .readlink      = btrfs_readlink,
     .getfssec      = btrfs_getfssec,
     .close_file    = generic_close_file,
     .mangle_name   = generic_mangle_name,
-    .next_extent   = btrfs_next_extent,
     .readdir       = btrfs_readdir,
     .chdir_start   = generic_chdir_start,
     .open_config   = generic_open_config,
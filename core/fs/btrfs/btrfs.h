@@ -53,6 +53,20 @@ typedef u64 __le64;
 #define BTRFS_FILE_EXTENT_REG 1
 #define BTRFS_FILE_EXTENT_PREALLOC 2
 
+#define BTRFS_COMPRESS_NONE 0
+#define BTRFS_COMPRESS_ZLIB 1
+#define BTRFS_COMPRESS_LZO  2
+#define BTRFS_COMPRESS_ZSTD 3
+
+#define BTRFS_BLOCK_GROUP_RAID0   (1ULL << 3)
+#define BTRFS_BLOCK_GROUP_RAID1   (1ULL << 4)
+#define BTRFS_BLOCK_GROUP_DUP     (1ULL << 5)
+#define BTRFS_BLOCK_GROUP_RAID10  (1ULL << 6)
+#define BTRFS_BLOCK_GROUP_RAID5   (1ULL << 7)
+#define BTRFS_BLOCK_GROUP_RAID6   (1ULL << 8)
+#define BTRFS_BLOCK_GROUP_RAID1C3 (1ULL << 9)
+#define BTRFS_BLOCK_GROUP_RAID1C4 (1ULL << 10)
+
 #define BTRFS_MAX_LEVEL 8
 #define BTRFS_MAX_CHUNK_ENTRIES 256
 
@@ -199,10 +213,16 @@ struct btrfs_path {
 struct btrfs_chunk_map_item {
 	u64 logical;
 	u64 length;
-	u64 devid;
-	u64 physical;
+	u64 type;
+	u64 stripe_len;
+	u16 num_stripes;
+	u16 sub_stripes;
+	u64 *physical;		/* per stripe, on the boot device */
 };
 
+/* physical address of a stripe that is not on the boot device */
+#define BTRFS_STRIPE_MISSING	(~0ULL)
+
 struct btrfs_chunk_map {
 	struct btrfs_chunk_map_item *map;
 	u32 map_length;
@@ -285,13 +305,45 @@ struct btrfs_root_ref {
 	__le16 name_len;
 } __attribute__ ((__packed__));
 
+/*
+ * A file extent item, decoded for reading.  For inline extents bytenr
+ * points at the data inside the leaf; for a hole or a preallocated
+ * extent it is zero.
+ */
+struct btrfs_extent {
+    uint64_t start;		/* First file byte covered */
+    uint64_t end;		/* File byte after the extent */
+    uint64_t bytenr;		/* Logical address of the (encoded) data */
+    uint64_t disk_bytes;	/* Bytes of encoded data at bytenr */
+    uint64_t offset;		/* Offset of start into the decoded data */
+    uint8_t type;
+    uint8_t compression;
+};
+
+struct btrfs_decomp;
+
 /*
  * btrfs private inode information
  */
 struct btrfs_pvt_inode {
-    uint64_t offset;
+    struct btrfs_extent extent;		/* Last extent looked up */
+    uint64_t leaf;			/* Leaf and slot of its item */
+    int slot;
+    struct btrfs_decomp *decomp;	/* Compressed extent decoder state */
 };
 
 #define PVT(i) ((struct btrfs_pvt_inode *)((i)->pvt))
 
+struct fs_info;
+
+/* btrfs.c */
+int btrfs_read_logical(struct fs_info *fs, void *buf, uint64_t logical,
+		       uint32_t len);
+
+/* compress.c */
+int btrfs_decompress(struct fs_info *fs, struct btrfs_decomp **decomp,
+		     const struct btrfs_extent *extent, uint32_t pos,
+		     char *buf, uint32_t len);
+void btrfs_decomp_free(struct btrfs_decomp *decomp);
+
 #endif
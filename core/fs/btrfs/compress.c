@@ -0,0 +1,271 @@
+/*
+ * compress.c -- btrfs compressed extent decoding for syslinux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, Inc., 53 Temple Place Ste 330,
+ * Boston MA 02111-1307, USA; either version 2 of the License, or
+ * (at your option) any later version; incorporated herein by reference.
+ *
+ */
+
+/*
+ * A compressed extent decodes to at most 128K, and is always decoded
+ * from its beginning.  Rather than decompressing whole extents into a
+ * buffer, the decoder state is kept with the inode and the output is
+ * produced directly into the caller's buffer, so a file read front to
+ * back decodes every extent exactly once, a few KB at a time.  Reading
+ * backwards restarts the extent.
+ *
+ * zlib extents are a single zlib stream.  LZO extents start with the
+ * total compressed length, followed by one segment per 4K of decoded
+ * data, each a length and an LZO1X block; a segment header never
+ * straddles a 4K boundary, it is moved to the next one instead.
+ */
+
+#include <dprintf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <minmax.h>
+#include <fs.h>
+#include <zlib.h>
+#include <lzo/lzo1x.h>
+#include "btrfs.h"
+
+#define LZO_LEN		4
+#define LZO_SEG_SIZE	BTRFS_BLOCK_SIZE
+/* lzo1x_worst_compress() of one segment */
+#define LZO_SEG_MAX	(LZO_SEG_SIZE + LZO_SEG_SIZE / 16 + 64 + 3)
+
+struct btrfs_decomp {
+    uint64_t bytenr;		/* Extent being decoded, 0 if none */
+    uint8_t compression;
+    bool zinit;			/* zs has been through inflateInit() */
+    uint32_t in_pos;		/* Encoded bytes consumed */
+    uint32_t out_pos;		/* Decoded bytes produced */
+    uint32_t tot_len;		/* LZO: total encoded length */
+    uint32_t seg_pos;		/* LZO: decoded offset of seg[] */
+    uint32_t seg_len;		/* LZO: bytes valid in seg[] */
+    z_stream zs;
+    char seg[LZO_SEG_SIZE];	/* Output not (yet) wanted by the caller */
+    char in[LZO_SEG_MAX];	/* Encoded input */
+};
+
+static int btrfs_inflate(struct fs_info *fs, struct btrfs_decomp *d,
+			 const struct btrfs_extent *extent, bool restart,
+			 uint32_t pos, char *buf, uint32_t len)
+{
+    z_stream *zs = &d->zs;
+    uint32_t want, got;
+    char *out;
+    int rv;
+
+    if (!d->zinit) {
+	memset(zs, 0, sizeof *zs);
+	if (inflateInit(zs) != Z_OK)
+	    return -1;
+	d->zinit = true;
+    } else if (restart || pos < d->out_pos) {
+	inflateReset(zs);
+    } else {
+	goto resume;
+    }
+
+    zs->avail_in = 0;
+    d->in_pos = d->out_pos = 0;
+
+resume:
+    while (len) {
+	/* Output ahead of pos is decoded into seg[] and dropped */
+	if (d->out_pos < pos) {
+	    out = d->seg;
+	    want = min(pos - d->out_pos, (uint32_t)sizeof d->seg);
+	} else {
+	    out = buf;
+	    want = len;
+	}
+
+	if (!zs->avail_in) {
+	    zs->avail_in = min(extent->disk_bytes - d->in_pos,
+			       (uint64_t)BTRFS_BLOCK_SIZE);
+	    if (!zs->avail_in)
+		break;
+	    if (btrfs_read_logical(fs, d->in, extent->bytenr + d->in_pos,
+				   zs->avail_in))
+		return -1;
+	    zs->next_in = (Bytef *)d->in;
+	    d->in_pos += zs->avail_in;
+	}
+
+	zs->next_out = (Bytef *)out;
+	zs->avail_out = want;
+	rv = inflate(zs, Z_SYNC_FLUSH);
+	got = want - zs->avail_out;
+	d->out_pos += got;
+	if (out == buf) {
+	    buf += got;
+	    len -= got;
+	}
+
+	if (rv == Z_STREAM_END)
+	    break;
+	if (rv != Z_OK && !(rv == Z_BUF_ERROR && !zs->avail_in)) {
+	    printf("btrfs: zlib error %d\n", rv);
+	    return -1;
+	}
+    }
+
+    /* The stream ended short of the extent; the rest reads as zero */
+    memset(buf, 0, len);
+    return 0;
+}
+
+static int btrfs_unlzo(struct fs_info *fs, struct btrfs_decomp *d,
+		       const struct btrfs_extent *extent, bool restart,
+		       uint32_t pos, char *buf, uint32_t len)
+{
+    uint32_t seg_len, n;
+    lzo_uint out_len;
+    char *out;
+
+    if (restart || (pos < d->out_pos &&
+		    (pos < d->seg_pos || pos >= d->seg_pos + d->seg_len))) {
+	if (extent->disk_bytes < LZO_LEN)
+	    return -1;
+	if (btrfs_read_logical(fs, &d->tot_len, extent->bytenr, LZO_LEN) ||
+	    d->tot_len > extent->disk_bytes)
+	    return -1;
+	d->in_pos = LZO_LEN;
+	d->out_pos = 0;
+	d->seg_len = 0;
+    }
+
+    while (len) {
+	/* Part of the segment decoded by the previous call */
+	if (pos >= d->seg_pos && pos < d->seg_pos + d->seg_len) {
+	    n = min(len, d->seg_pos + d->seg_len - pos);
+	    memcpy(buf, d->seg + (pos - d->seg_pos), n);
+	    buf += n;
+	    pos += n;
+	    len -= n;
+	    continue;
+	}
+
+	if (LZO_SEG_SIZE - (d->in_pos & (LZO_SEG_SIZE - 1)) < LZO_LEN)
+	    d->in_pos = (d->in_pos + LZO_SEG_SIZE - 1) & ~(LZO_SEG_SIZE - 1);
+	if (d->in_pos + LZO_LEN > d->tot_len)
+	    break;
+
+	if (btrfs_read_logical(fs, &seg_len, extent->bytenr + d->in_pos,
+			       LZO_LEN))
+	    return -1;
+	if (seg_len > LZO_SEG_MAX ||
+	    d->in_pos + LZO_LEN + seg_len > d->tot_len) {
+	    printf("btrfs: bad LZO segment\n");
+	    return -1;
+	}
+
+	/* Every segment but the last decodes to a full LZO_SEG_SIZE */
+	if (d->out_pos + LZO_SEG_SIZE <= pos) {
+	    d->in_pos += LZO_LEN + seg_len;
+	    d->out_pos += LZO_SEG_SIZE;
+	    continue;
+	}
+
+	if (btrfs_read_logical(fs, d->in, extent->bytenr + d->in_pos + LZO_LEN,
+			       seg_len))
+	    return -1;
+	d->in_pos += LZO_LEN + seg_len;
+
+	/* Decode straight into the caller's buffer whenever it fits */
+	if (pos == d->out_pos && len >= LZO_SEG_SIZE)
+	    out = buf;
+	else
+	    out = d->seg;
+
+	out_len = LZO_SEG_SIZE;
+	if (lzo1x_decompress_safe((unsigned char *)d->in, seg_len,
+				  (unsigned char *)out, &out_len,
+				  NULL) != LZO_E_OK) {
+	    printf("btrfs: LZO decompression failed\n");
+	    return -1;
+	}
+
+	if (out == buf) {
+	    buf += out_len;
+	    pos += out_len;
+	    len -= out_len;
+	} else {
+	    d->seg_pos = d->out_pos;
+	    d->seg_len = out_len;
+	}
+	d->out_pos += out_len;
+    }
+
+    memset(buf, 0, len);
+    return 0;
+}
+
+/*
+ * Decode len bytes of a compressed extent into buf, starting pos bytes
+ * into its decoded data.  *decomp is the decoder state for the inode,
+ * allocated on first use.
+ */
+int btrfs_decompress(struct fs_info *fs, struct btrfs_decomp **decomp,
+		     const struct btrfs_extent *extent, uint32_t pos,
+		     char *buf, uint32_t len)
+{
+    struct btrfs_decomp *d = *decomp;
+    bool restart;
+    int rv;
+
+    if (!d) {
+	d = *decomp = zalloc(sizeof *d);
+	if (!d)
+	    return -1;
+    }
+
+    /*
+     * Split and cloned file extents may share the encoded data, so it
+     * is the data that identifies the stream, not the file extent.
+     */
+    restart = d->bytenr != extent->bytenr ||
+	d->compression != extent->compression;
+    d->bytenr = extent->bytenr;
+    d->compression = extent->compression;
+
+    dprintf("btrfs: decode %llu type %u @ %u len %u%s\n", extent->bytenr,
+	    extent->compression, pos, len, restart ? " (restart)" : "");
+
+    switch (extent->compression) {
+    case BTRFS_COMPRESS_ZLIB:
+	rv = btrfs_inflate(fs, d, extent, restart, pos, buf, len);
+	break;
+    case BTRFS_COMPRESS_LZO:
+	rv = btrfs_unlzo(fs, d, extent, restart, pos, buf, len);
+	break;
+    default:
+	printf("btrfs: unsupported compression type %u\n",
+	       extent->compression);
+	rv = -1;
+	break;
+    }
+
+    /* The decoder state is unknown after an error */
+    if (rv)
+	d->bytenr = 0;
+
+    return rv;
+}
+
+void btrfs_decomp_free(struct btrfs_decomp *decomp)
+{
+    if (!decomp)
+	return;
+
+    if (decomp->zinit)
+	inflateEnd(&decomp->zs);
+    free(decomp);
+}
@@ -1,63 +1,301 @@
 /*
  * core/cache.c: A simple LRU-based cache implementation.
  *
+ * Blocks are looked up through an open-addressed (linear probing)
+ * hash index over block numbers, so the lookup cost does not depend
+ * on the number of cache entries.
  */
 
 #include <stdio.h>
 #include <string.h>
 #include <dprintf.h>
+#include <ilog2.h>
+#include <minmax.h>
 #include "core.h"
 #include "cache.h"
 
+#define CACHE_NOBLOCK	((block_t)-1)
+
+/*
+ * Size of the read-ahead bounce buffer; this bounds the read-ahead
+ * window together with the disk's maxtransfer.
+ */
+#define CACHE_RA_SIZE		(64 << 10)
+
+/*
+ * Number of hash slots budgeted per cache entry; the actual table size
+ * is rounded down to a power of two, which keeps the load factor below
+ * one half.
+ */
+#define CACHE_HASH_SLOTS	4
+
+static inline uint32_t cache_hash(const struct device *dev, block_t block)
+{
+    uint32_t h = (uint32_t)block ^ (uint32_t)(block >> 32);
+
+    return (h * 0x9e3779b1) >> dev->cache_hash_shift;
+}
+
+static inline uint32_t cache_hash_mask(const struct device *dev)
+{
+    return ~(uint32_t)0 >> dev->cache_hash_shift;
+}
+
+/*
+ * Add a cache descriptor to the hash index under cs->block.
+ */
+static void cache_hash_insert(struct device *dev, struct cache *cs)
+{
+    struct cache **hash = dev->cache_hash;
+    uint32_t mask = cache_hash_mask(dev);
+    uint32_t i = cache_hash(dev, cs->block);
+
+    while (hash[i])
+	i = (i + 1) & mask;
+
+    hash[i] = cs;
+}
+
+/*
+ * Remove a cache descriptor from the hash index.  This uses backward
+ * shift deletion, so no tombstones are ever left in the table.
+ */
+static void cache_hash_remove(struct device *dev, struct cache *cs)
+{
+    struct cache **hash = dev->cache_hash;
+    uint32_t mask = cache_hash_mask(dev);
+    uint32_t i, j, k;
+
+    i = cache_hash(dev, cs->block);
+    while (hash[i] != cs) {
+	if (!hash[i])
+	    return;		/* Not hashed */
+	i = (i + 1) & mask;
+    }
+
+    j = i;
+    for (;;) {
+	j = (j + 1) & mask;
+	if (!hash[j])
+	    break;
+
+	/* Leave the entry alone if its home slot is cyclically in (i,j] */
+	k = cache_hash(dev, hash[j]->block);
+	if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+	    continue;
+
+	hash[i] = hash[j];
+	i = j;
+    }
+
+    hash[i] = NULL;
+}
+
+static struct cache *cache_hash_lookup(struct device *dev, block_t block)
+{
+    struct cache **hash = dev->cache_hash;
+    uint32_t mask = cache_hash_mask(dev);
+    uint32_t i = cache_hash(dev, block);
+    struct cache *cs;
+
+    while ((cs = hash[i])) {
+	if (cs->block == block)
+	    return cs;
+	i = (i + 1) & mask;
+    }
+
+    return NULL;
+}
+
+/*
+ * Set up the hash index at _hash_, which has room for _bytes_ bytes,
+ * and (re)insert every cached block into it.
+ */
+static void cache_hash_init(struct device *dev, void *hash, uint32_t bytes)
+{
+    struct cache *cs;
+    struct cache_arena *arena;
+    uint32_t i, entries;
+
+    dev->cache_hash = hash;
+    dev->cache_hash_shift = 32 - ilog2(bytes / sizeof(struct cache *));
+    memset(dev->cache_hash, 0,
+	   (cache_hash_mask(dev) + 1) * sizeof(struct cache *));
+
+    /*
+     * Walk the descriptor arrays rather than the LRU chain, so that
+     * locked blocks are found too.
+     */
+    entries = dev->cache_entries;
+    for (arena = dev->cache_arenas; arena; arena = arena->next) {
+	entries -= arena->entries;
+	cs = (struct cache *)(arena + 1);
+	for (i = 0; i < arena->entries; i++, cs++) {
+	    if (cs->block != CACHE_NOBLOCK)
+		cache_hash_insert(dev, cs);
+	}
+    }
+
+    cs = dev->cache_head + 1;
+    for (i = 0; i < entries; i++, cs++) {
+	if (cs->block != CACHE_NOBLOCK)
+	    cache_hash_insert(dev, cs);
+    }
+}
+
+/*
+ * Carve _entries_ cache descriptors at _cache_ for the data blocks at
+ * _data_, and put them at the front of the LRU chain, so they are
+ * the first ones to be picked as victims.
+ */
+static void cache_add_blocks(struct device *dev, struct cache *cache,
+			     char *data, uint32_t entries)
+{
+    struct cache *head = dev->cache_head;
+    struct cache *first = head->next;
+    struct cache *prev, *cur;
+    uint32_t i;
+
+    prev = head;
+    for (i = 0; i < entries; i++) {
+	cur = &cache[i];
+	cur->data  = data;
+	cur->block = CACHE_NOBLOCK;
+	cur->prev  = prev;
+	prev->next = cur;
+	data += dev->cache_block_size;
+	prev = cur;
+    }
+
+    prev->next = first;
+    first->prev = prev;
+
+    dev->cache_entries += entries;
+}
+
+/*
+ * Number of cache entries which fit in _bytes_ bytes of memory, when
+ * _hashed_ entries already exist.  Each entry needs a data block, a
+ * descriptor, and CACHE_HASH_SLOTS hash index slots.
+ */
+static uint32_t cache_fit_entries(struct device *dev, uint32_t bytes,
+				  uint32_t hashed)
+{
+    uint32_t overhead = hashed * CACHE_HASH_SLOTS * sizeof(struct cache *);
+
+    if (bytes < overhead)
+	return 0;
+
+    return (bytes - overhead) /
+	(dev->cache_block_size + sizeof(struct cache) +
+	 CACHE_HASH_SLOTS*sizeof(struct cache *));
+}
 
 /*
  * Initialize the cache data structres. the _block_size_shift_ specify
  * the block size, which is 512 byte for FAT fs of the current 
  * implementation since the block(cluster) size in FAT is a bit big.
+ *
+ * The cache memory is laid out as the data blocks, followed by the
+ * LRU head node and the block descriptors, followed by the hash index.
  */
 void cache_init(struct device *dev, int block_size_shift)
 {
-    struct cache *prev, *cur;
     char *data = dev->cache_data;
-    struct cache *head, *cache;
-    int i;
+    struct cache *head;
+    uint32_t entries;
 
     dev->cache_block_size = 1 << block_size_shift;
+    dev->cache_entries = 0;
+    dev->cache_arenas = NULL;
 
-    if (dev->cache_size < dev->cache_block_size + 2*sizeof(struct cache)) {
+    /* We need one struct cache for the headnode plus one for each block */
+    entries = 0;
+    if (dev->cache_size > sizeof(struct cache))
+	entries = cache_fit_entries(dev, dev->cache_size - sizeof(struct cache),
+				    0);
+    if (!entries) {
 	dev->cache_head = NULL;
 	return;			/* Cache unusably small */
     }
 
-    /* We need one struct cache for the headnode plus one for each block */
-    dev->cache_entries =
-	(dev->cache_size - sizeof(struct cache))/
-	(dev->cache_block_size + sizeof(struct cache));
-
     dev->cache_head = head = (struct cache *)
-	(data + (dev->cache_entries << block_size_shift));
-    cache = head + 1;		/* First cache descriptor */
+	(data + (entries << block_size_shift));
 
-    head->prev  = &cache[dev->cache_entries-1];
-    head->prev->next = head;
-    head->block = -1;
+    head->prev  = head->next = head;
+    head->block = CACHE_NOBLOCK;
     head->data  = NULL;
 
-    prev = head;
-    
-    for (i = 0; i < dev->cache_entries; i++) {
-        cur = &cache[i];
-        cur->data  = data;
-        cur->block = -1;
-        cur->prev  = prev;
-        prev->next = cur;
-        data += dev->cache_block_size;
-        prev = cur++;
-    }
+    cache_add_blocks(dev, head + 1, data, entries);
+
+    /* Whatever is left over after the descriptors is the hash index */
+    cache_hash_init(dev, head + 1 + entries,
+		    dev->cache_size - ((char *)(head + 1 + entries) - data));
+
+    dev->cache_hits = dev->cache_misses = dev->cache_evictions = 0;
+    dev->cache_readahead = 0;
+    dev->cache_ra_next = CACHE_NOBLOCK;
 
     dev->cache_init = 1; /* Set cache as initialized */
 }
 
+/*
+ * Grow an initialized cache in place by _bytes_ bytes.  Blocks already
+ * in the cache, including locked ones, stay where they are; the new
+ * memory holds additional blocks and a larger hash index.
+ *
+ * The memory is laid out as the data blocks, the arena header, the
+ * block descriptors and the new hash index.
+ */
+int cache_grow(struct device *dev, uint32_t bytes)
+{
+    struct cache_arena *arena;
+    struct cache *desc;
+    uint32_t entries;
+    char *mem;
+
+    if (!dev->cache_head || bytes < sizeof(struct cache_arena))
+	return -1;
+
+    entries = cache_fit_entries(dev, bytes - sizeof(struct cache_arena),
+				dev->cache_entries);
+    if (!entries)
+	return -1;
+
+    mem = malloc(bytes);
+    if (!mem)
+	return -1;
+
+    arena = (struct cache_arena *)(mem + entries * dev->cache_block_size);
+    arena->size = bytes;
+    arena->entries = entries;
+    desc = (struct cache *)(arena + 1);
+
+    cache_add_blocks(dev, desc, mem, entries);
+
+    arena->next = dev->cache_arenas;
+    dev->cache_arenas = arena;
+
+    cache_hash_init(dev, desc + entries,
+		    bytes - ((char *)(desc + entries) - mem));
+
+    return 0;
+}
+
+/*
+ * Total amount of memory used by the cache, in bytes.
+ */
+static uint32_t cache_total_size(const struct device *dev)
+{
+    const struct cache_arena *arena;
+    uint32_t size = dev->cache_size;
+
+    for (arena = dev->cache_arenas; arena; arena = arena->next)
+	size += arena->size;
+
+    return size;
+}
+
 /*
  * Lock a block permanently in the cache by removing it
  * from the LRU chain.
@@ -71,29 +309,12 @@ void cache_lock_block(struct cache *cs)
 }
 
 /*
- * Check for a particular BLOCK in the block cache, 
- * and if it is already there, just do nothing and return;
- * otherwise pick a victim block and update the LRU link.
+ * Move a block to the end of the LRU chain, unless it is locked.
  */
-struct cache *_get_cache_block(struct device *dev, block_t block)
+static void cache_touch(struct device *dev, struct cache *cs)
 {
     struct cache *head = dev->cache_head;
-    struct cache *cs;
-    int i;
 
-    cs = dev->cache_head + 1;
-
-    for (i = 0; i < dev->cache_entries; i++) {
-	if (cs->block == block)
-	    goto found;
-	cs++;
-    }
-    
-    /* Not found, pick a victim */
-    cs = head->next;
-
-found:
-    /* Move to the end of the LRU chain, unless the block is already locked */
     if (cs->next) {
 	cs->prev->next = cs->next;
 	cs->next->prev = cs->prev;
@@ -103,15 +324,116 @@ found:
 	cs->next = head;
 	head->prev = cs;
     }
+}
 
+/*
+ * Pick the least recently used block as a victim, drop it from the
+ * hash index and move it to the end of the LRU chain.
+ */
+static struct cache *cache_victim(struct device *dev)
+{
+    struct cache *cs = dev->cache_head->next;
+
+    if (cs->block != CACHE_NOBLOCK) {
+	dev->cache_evictions++;
+	cache_hash_remove(dev, cs);
+	cs->block = CACHE_NOBLOCK;
+    }
+
+    cache_touch(dev, cs);
     return cs;
+}
+
+/*
+ * Check for a particular BLOCK in the block cache, 
+ * and if it is already there, just do nothing and return;
+ * otherwise pick a victim block and update the LRU link.
+ *
+ * A victim is removed from the hash index and returned with its
+ * block number set to CACHE_NOBLOCK; it is up to the caller to
+ * fill it in (see get_cache()).
+ */
+struct cache *_get_cache_block(struct device *dev, block_t block)
+{
+    struct cache *cs;
+
+    cs = cache_hash_lookup(dev, block);
+    if (cs) {
+	dev->cache_hits++;
+	cache_touch(dev, cs);
+	return cs;
+    }
+
+    /* Not found, pick a victim */
+    dev->cache_misses++;
+    return cache_victim(dev);
 }    
 
+/*
+ * Read _block_ into the victim _cs_, together with the blocks following
+ * it which are not cached yet, with a single transfer, and add them
+ * all to the cache.  Returns false if no read-ahead was possible.
+ */
+static bool cache_readahead(struct device *dev, struct cache *cs,
+			    block_t block)
+{
+    struct disk *disk = dev->disk;
+    uint32_t sec_per_block = dev->cache_block_size >> disk->sector_shift;
+    uint32_t n, max, got;
+    const char *p;
+
+    max = disk->maxtransfer / sec_per_block;
+    max = min(max, (uint32_t)(CACHE_RA_SIZE / dev->cache_block_size));
+    max = min(max, dev->cache_entries / 4);
+    if (max < 2)
+	return false;
+
+    if (!dev->cache_ra_buf) {
+	dev->cache_ra_buf = malloc(CACHE_RA_SIZE);
+	if (!dev->cache_ra_buf)
+	    return false;
+    }
+
+    /* Stop at the first block which is already cached */
+    for (n = 1; n < max; n++) {
+	if (cache_hash_lookup(dev, block + n))
+	    break;
+    }
+    if (n < 2)
+	return false;
+
+    got = disk->rdwr_sectors(disk, dev->cache_ra_buf, block * sec_per_block,
+			     n * sec_per_block, 0) / sec_per_block;
+    if (!got)
+	return false;
+
+    p = dev->cache_ra_buf;
+    cs->block = block;
+    cache_hash_insert(dev, cs);
+    memcpy(cs->data, p, dev->cache_block_size);
+
+    /* cs is the most recently used block, so it can't be a victim here */
+    for (n = 1; n < got; n++) {
+	p += dev->cache_block_size;
+	cs = cache_victim(dev);
+	cs->block = block + n;
+	cache_hash_insert(dev, cs);
+	memcpy(cs->data, p, dev->cache_block_size);
+    }
+
+    dev->cache_readahead += got - 1;
+    dev->cache_ra_next = block + got;
+    return true;
+}
+
 /*
  * Check for a particular BLOCK in the block cache, 
  * and if it is already there, just do nothing and return;
  * otherwise load it from disk and update the LRU link.
  * Return the data pointer.
+ *
+ * A miss on the block right after the previous miss is taken as
+ * a sequential scan, and triggers a read-ahead.
  */
 const void *get_cache(struct device *dev, block_t block)
 {
@@ -119,8 +441,13 @@ const void *get_cache(struct device *dev, block_t block)
 
     cs = _get_cache_block(dev, block);
     if (cs->block != block) {
+	if (block == dev->cache_ra_next && cache_readahead(dev, cs, block))
+	    return cs->data;
+
 	cs->block = block;
+	cache_hash_insert(dev, cs);
         getoneblk(dev->disk, cs->data, block, dev->cache_block_size);
+	dev->cache_ra_next = block + 1;
     }
 
     return cs->data;
@@ -157,3 +484,53 @@ size_t cache_read(struct fs_info *fs, void *buf, uint64_t offset, size_t count)
     }
     return total - count;
 }
+
+/*
+ * Return the block cache statistics of the current filesystem device.
+ * Returns -1 if the filesystem has no block cache.
+ */
+__export int cache_get_stats(struct cache_stats *st)
+{
+    struct device *dev;
+
+    memset(st, 0, sizeof *st);
+
+    if (!this_fs || !(dev = this_fs->fs_dev) || !dev->cache_head)
+	return -1;
+
+    st->size       = cache_total_size(dev);
+    st->block_size = dev->cache_block_size;
+    st->entries    = dev->cache_entries;
+    st->hits       = dev->cache_hits;
+    st->misses     = dev->cache_misses;
+    st->evictions  = dev->cache_evictions;
+    st->readahead  = dev->cache_readahead;
+
+    return 0;
+}
+
+/*
+ * Grow the block cache of the current filesystem device to at least
+ * _size_ bytes.  The cache is never shrunk.
+ */
+__export int cache_set_size(uint32_t size)
+{
+    struct device *dev;
+    uint32_t cur;
+
+    if (!this_fs)
+	return -1;
+
+    /* No block device, e.g. PXELINUX: there is nothing to cache */
+    dev = this_fs->fs_dev;
+    if (!dev)
+	return 0;
+    if (!dev->cache_head)
+	return -1;
+
+    cur = cache_total_size(dev);
+    if (size <= cur)
+	return 0;
+
+    return cache_grow(dev, size - cur);
+}
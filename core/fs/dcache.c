@@ -0,0 +1,138 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Permission is hereby granted, free of charge, to any person
+ *   obtaining a copy of this software and associated documentation
+ *   files (the "Software"), to deal in the Software without
+ *   restriction, including without limitation the rights to use,
+ *   copy, modify, merge, publish, distribute, sublicense, and/or
+ *   sell copies of the Software, and to permit persons to whom
+ *   the Software is furnished to do so, subject to the following
+ *   conditions:
+ *
+ *   The above copyright notice and this permission notice shall
+ *   be included in all copies or substantial portions of the Software.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *   OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ *   HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ *   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ *   OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * dcache.c
+ *
+ * A small cache of path component lookups for the generic searchdir().
+ * Each entry maps (directory inode, name) to the inode iget() returned
+ * for it, or to nothing at all if iget() failed, so that probing the
+ * same paths over and over (PATH, module autoloading, menus looking for
+ * files) does not rescan the same directory blocks every time.
+ *
+ * A positive entry holds a reference to its inode, which in turn holds
+ * its parent; a negative entry holds a reference to the directory.
+ * Either way the directory pointer used as the key stays valid for as
+ * long as the entry exists.  The cache is bounded and the least
+ * recently used entry is recycled when it is full.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <dprintf.h>
+#include "fs.h"
+
+#define DCACHE_ENTRIES	64
+
+struct dentry {
+    struct inode *dir;		/* Directory searched, NULL if unused */
+    struct inode *inode;	/* Result, NULL for a negative entry */
+    char *name;
+    uint32_t hash;
+    uint32_t stamp;		/* Last use, for LRU replacement */
+};
+
+static struct dentry dcache[DCACHE_ENTRIES];
+static uint32_t dcache_clock;
+
+static uint32_t dcache_hash(const struct inode *dir, const char *name)
+{
+    uint32_t hash = (uint32_t)(uintptr_t)dir;
+
+    while (*name)
+	hash = (hash ^ (uint8_t)*name++) * 16777619;
+
+    return hash;
+}
+
+static void dcache_drop(struct dentry *d)
+{
+    if (d->inode)
+	put_inode(d->inode);
+    else
+	put_inode(d->dir);
+    free(d->name);
+    d->dir = NULL;
+    d->inode = NULL;
+    d->name = NULL;
+}
+
+/*
+ * Look up name in dir.  Returns true on a hit, in which case *inode is
+ * set to a new reference to the cached inode, or to NULL if the name is
+ * known not to exist.
+ */
+bool dcache_lookup(struct inode *dir, const char *name, struct inode **inode)
+{
+    struct dentry *d;
+    uint32_t hash;
+
+    hash = dcache_hash(dir, name);
+    for (d = dcache; d < &dcache[DCACHE_ENTRIES]; d++) {
+	if (d->dir == dir && d->hash == hash && !strcmp(d->name, name)) {
+	    d->stamp = ++dcache_clock;
+	    *inode = d->inode ? get_inode(d->inode) : NULL;
+	    dprintf("dcache: hit %p/%s -> %p\n", dir, name, *inode);
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+/*
+ * Remember the result of looking up name in dir; inode is NULL if the
+ * lookup failed.  The cache takes its own reference.
+ */
+void dcache_insert(struct inode *dir, const char *name, struct inode *inode)
+{
+    struct dentry *d, *victim;
+    char *dname;
+
+    dname = strdup(name);
+    if (!dname)
+	return;
+
+    victim = dcache;
+    for (d = dcache; d < &dcache[DCACHE_ENTRIES]; d++) {
+	if (!d->dir) {
+	    victim = d;
+	    break;
+	}
+	if (d->stamp < victim->stamp)
+	    victim = d;
+    }
+
+    if (victim->dir)
+	dcache_drop(victim);
+
+    victim->dir   = dir;
+    victim->inode = inode ? get_inode(inode) : NULL;
+    if (!inode)
+	get_inode(dir);
+    victim->name  = dname;
+    victim->hash  = dcache_hash(dir, name);
+    victim->stamp = ++dcache_clock;
+}
@@ -10,6 +10,16 @@
 #include <minmax.h>
 
 #include <syslinux/firmware.h>
+#include <syslinux/memscan.h>
+
+/*
+ * The default block cache size is a fraction of the free high memory
+ * reported by the firmware memory map, within these bounds.  It can be
+ * grown later with the DISKCACHE configuration directive.
+ */
+#define CACHE_SIZE_MIN		(128 << 10)
+#define CACHE_SIZE_MAX		(32 << 20)
+#define CACHE_SIZE_SHIFT	7	/* 1/128 of free memory */
 
 void getoneblk(struct disk *disk, char *buf, block_t block, int block_size)
 {
@@ -18,6 +28,28 @@ void getoneblk(struct disk *disk, char *buf, block_t block, int block_size)
     disk->rdwr_sectors(disk, buf, block * sec_per_block, sec_per_block, 0);
 }
 
+static int count_free_memory(void *data, addr_t start, addr_t len,
+			     enum syslinux_memmap_types type)
+{
+    uint64_t *free_mem = data;
+
+    if (type == SMT_FREE && start >= 0x100000)
+	*free_mem += len;
+
+    return 0;
+}
+
+static uint32_t default_cache_size(void)
+{
+    uint64_t free_mem = 0;
+
+    syslinux_scan_memory(count_free_memory, &free_mem);
+    free_mem >>= CACHE_SIZE_SHIFT;
+
+    return max(min(free_mem, (uint64_t)CACHE_SIZE_MAX),
+	       (uint64_t)CACHE_SIZE_MIN);
+}
+
 /*
  * Initialize the device structure.
  */
@@ -26,8 +58,12 @@ struct device * device_init(void *args)
     static struct device dev;
 
     dev.disk = firmware->disk_init(args);
-    dev.cache_size = 128*1024;
+    dev.cache_size = default_cache_size();
     dev.cache_data = malloc(dev.cache_size);
+    if (!dev.cache_data) {
+	dev.cache_size = CACHE_SIZE_MIN;
+	dev.cache_data = malloc(dev.cache_size);
+    }
     dev.cache_init = 0; /* Explicitly set cache as uninitialized */
 
     return &dev;
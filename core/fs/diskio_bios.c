@@ -2,6 +2,7 @@
 #include <com32.h>
 #include <fs.h>
 #include <ilog2.h>
+#include <errno.h>
 
 #define RETRY_COUNT 6
 
@@ -140,6 +141,7 @@ static int chs_rdwr_sectors(struct disk *disk, void *buf,
 		   oreg.eax.w[0],
 		   is_write ? "writing" : "reading",
 		   lba, c, h, s+1);
+	    errno = EIO;
 	    return done;	/* Failure */
 	}
 
@@ -266,6 +268,7 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
 		   oreg.eax.w[0],
 		   is_write ? "writing" : "reading",
 		   lba);
+	    errno = EIO;
 	    return done;	/* Failure */
 	}
 
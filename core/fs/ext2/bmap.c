@@ -6,77 +6,156 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <dprintf.h>
+#include <minmax.h>
 #include <fs.h>
 #include <disk.h>
 #include <cache.h>
 #include "ext2_fs.h"
 
-static const struct ext4_extent_header *
-ext4_find_leaf(struct fs_info *fs, const struct ext4_extent_header *eh,
-	       block_t block)
+/*
+ * Decode an extent leaf into the inode's leaf cache, which then covers
+ * logical blocks [start, end).
+ */
+static int ext4_cache_leaf(struct inode *inode,
+			   const struct ext4_extent_header *leaf,
+			   uint32_t start, uint32_t end)
 {
-    struct ext4_extent_idx *index;
-    block_t blk;
+    struct ext2_pvt_inode *pvt = PVT(inode);
+    const struct ext4_extent *ext = EXT4_FIRST_EXTENT(leaf);
+    struct ext2_extent *e;
     int i;
 
+    if (leaf->eh_entries > pvt->e_alloc) {
+	e = realloc(pvt->e_leaf, leaf->eh_entries * sizeof *e);
+	if (!e)
+	    return -1;
+	pvt->e_leaf  = e;
+	pvt->e_alloc = leaf->eh_entries;
+    }
+
+    e = pvt->e_leaf;
+    for (i = 0; i < leaf->eh_entries; i++) {
+	e[i].lblock = ext[i].ee_block;
+	if (ext[i].ee_len > EXT4_INIT_MAX_LEN) {
+	    /* Unwritten extent: reads as zero */
+	    e[i].len    = ext[i].ee_len - EXT4_INIT_MAX_LEN;
+	    e[i].pblock = 0;
+	} else {
+	    e[i].len    = ext[i].ee_len;
+	    e[i].pblock = ((block_t)ext[i].ee_start_hi << 32) +
+		ext[i].ee_start_lo;
+	}
+    }
+
+    pvt->e_count = leaf->eh_entries;
+    pvt->e_start = start;
+    pvt->e_end   = end;
+    return 0;
+}
+
+/*
+ * Walk the extent tree down to the leaf covering block, narrowing the
+ * range of logical blocks the leaf is responsible for on the way, and
+ * cache it.
+ */
+static int ext4_find_leaf(struct inode *inode, block_t block)
+{
+    struct fs_info *fs = inode->fs;
+    const struct ext4_extent_header *eh = &PVT(inode)->i_extent_hdr;
+    const struct ext4_extent_idx *index;
+    uint32_t start = 0, end = ~0U;
+    block_t blk;
+    int lo, hi, mid;
+
     while (1) {
 	if (eh->eh_magic != EXT4_EXT_MAGIC)
-	    return NULL;
+	    return -1;
 	if (eh->eh_depth == 0)
-	    return eh;
+	    return ext4_cache_leaf(inode, eh, start, end);
+
+	if (!eh->eh_entries)
+	    return -1;
 
+	/*
+	 * Find the last index whose first block is <= block; a hole
+	 * before the first one belongs to the first subtree.
+	 */
 	index = EXT4_FIRST_INDEX(eh);
-	for (i = 0; i < (int)eh->eh_entries; i++) {
-	    if (block < index[i].ei_block)
-		break;
+	lo = 0;
+	hi = eh->eh_entries;
+	while (lo < hi) {
+	    mid = (lo + hi) >> 1;
+	    if (block < index[mid].ei_block)
+		hi = mid;
+	    else
+		lo = mid + 1;
+	}
+	if (lo) {
+	    lo--;
+	    start = max(start, index[lo].ei_block);
 	}
-	if (--i < 0)
-	    return NULL;
+	if (lo + 1 < eh->eh_entries)
+	    end = min(end, index[lo+1].ei_block);
 
-	blk = index[i].ei_leaf_hi;
-	blk = (blk << 32) + index[i].ei_leaf_lo;
+	blk = index[lo].ei_leaf_hi;
+	blk = (blk << 32) + index[lo].ei_leaf_lo;
 	eh = get_cache(fs->fs_dev, blk);
     }
 }
 
-/* handle the ext4 extents to get the phsical block number */
-/* XXX: still need to handle sparse files with extents */
+/*
+ * Handle the ext4 extents to get the physical block number.  The leaf
+ * last used is kept decoded in the inode, so mapping a file front to
+ * back only walks the tree once per leaf.
+ */
 static block_t
 bmap_extent(struct inode *inode, uint32_t block, size_t *nblocks)
 {
-    struct fs_info *fs = inode->fs;
-    const struct ext4_extent_header *leaf;
-    const struct ext4_extent *ext;
-    int i;
-    block_t start;
+    struct ext2_pvt_inode *pvt = PVT(inode);
+    const struct ext2_extent *e;
+    int lo, hi, mid;
 
-    leaf = ext4_find_leaf(fs, &PVT(inode)->i_extent_hdr, block);
-    if (!leaf) {
-	printf("ERROR, extent leaf not found\n");
-	return 0;
+    if (!pvt->e_leaf || block < pvt->e_start || block >= pvt->e_end) {
+	if (ext4_find_leaf(inode, block)) {
+	    printf("ERROR, extent leaf not found\n");
+	    return 0;
+	}
     }
 
-    ext = EXT4_FIRST_EXTENT(leaf);
-    for (i = 0; i < leaf->eh_entries; i++) {
-	if (block < ext[i].ee_block)
-	    break;
-    }
-    if (--i < 0) {
-	printf("ERROR, not find the right block\n");
-	return 0;
+    /* Find the last extent starting at or before block */
+    e = pvt->e_leaf;
+    lo = 0;
+    hi = pvt->e_count;
+    while (lo < hi) {
+	mid = (lo + hi) >> 1;
+	if (block < e[mid].lblock)
+	    hi = mid;
+	else
+	    lo = mid + 1;
     }
 
-    /* got it */
-    block -= ext[i].ee_block;
-    if (block >= ext[i].ee_len)
-	return 0;
-    start = ((block_t)ext[i].ee_start_hi << 32) + ext[i].ee_start_lo;
+    if (lo && block - e[lo-1].lblock < e[lo-1].len) {
+	/* got it */
+	e += lo - 1;
+	block -= e->lblock;
+	if (nblocks)
+	    *nblocks = e->len - block;
+	return e->pblock ? e->pblock + block : 0;
+    }
 
-    if (nblocks)
-	*nblocks = ext[i].ee_len - block;
+    /* A hole, up to the next extent, the end of the leaf or of the file */
+    if (nblocks) {
+	struct fs_info *fs = inode->fs;
+	uint32_t end = (inode->size + BLOCK_SIZE(fs) - 1) >> BLOCK_SHIFT(fs);
 
-    return start + block;
+	if (lo < pvt->e_count)
+	    end = min(end, e[lo].lblock);
+	end = min(end, pvt->e_end);
+	*nblocks = end > block ? end - block : 1;
+    }
+    return 0;
 }
 
 /*
@@ -26,31 +26,46 @@ static enum dirent_type ext2_cvt_type(unsigned int d_file_type)
 }
 
 /*
- * get the group's descriptor of group_num
+ * Decode the inode table location of every group from the group
+ * descriptors, so looking up an inode doesn't go back to them.
  */
-static const struct ext2_group_desc *
-ext2_get_group_desc(struct fs_info *fs, uint32_t group_num)
+static int ext2_read_group_descs(struct fs_info *fs,
+				 const struct ext2_super_block *sb)
 {
     struct ext2_sb_info *sbi = EXT2_SB(fs);
-    uint32_t desc_block, desc_index;
-    const struct ext2_group_desc *desc_data_block;
-
-    if (group_num >= sbi->s_groups_count) {
-	printf ("ext2_get_group_desc"
-		"block_group >= groups_count - "
-		"block_group = %d, groups_count = %d",
-		group_num, sbi->s_groups_count);
-
-	return NULL;
+    const char *data = NULL;
+    const struct ext2_group_desc *desc;
+    const struct ext4_group_desc_hi *hi;
+    uint32_t group, desc_block, desc_index;
+    bool is_64bit = (sb->s_feature_incompat & EXT4_FEATURE_INCOMPAT_64BIT) &&
+	sb->s_desc_size >= EXT4_MIN_DESC_SIZE_64BIT;
+
+    sbi->s_inode_table = malloc(sbi->s_groups_count *
+				sizeof *sbi->s_inode_table);
+    if (!sbi->s_inode_table) {
+	malloc_error("ext2 group descriptor table");
+	return -1;
     }
 
-    desc_block = group_num / sbi->s_desc_per_block;
-    desc_index = group_num % sbi->s_desc_per_block;
-
-    desc_block += sbi->s_first_data_block + 1;
+    for (group = 0; group < sbi->s_groups_count; group++) {
+	desc_block = group / sbi->s_desc_per_block;
+	desc_index = group % sbi->s_desc_per_block;
+
+	if (!desc_index)
+	    data = get_cache(fs->fs_dev,
+			     desc_block + sbi->s_first_data_block + 1);
+
+	desc = (const struct ext2_group_desc *)
+	    (data + desc_index * sb->s_desc_size);
+	sbi->s_inode_table[group] = desc->bg_inode_table;
+	if (is_64bit) {
+	    hi = (const struct ext4_group_desc_hi *)(desc + 1);
+	    sbi->s_inode_table[group] +=
+		(block_t)hi->bg_inode_table_hi << 32;
+	}
+    }
 
-    desc_data_block = get_cache(fs->fs_dev, desc_block);
-    return &desc_data_block[desc_index];
+    return 0;
 }
 
 /*
@@ -85,6 +100,180 @@ ext2_get_cache(struct inode *inode, block_t lblock)
     return get_cache(inode->fs->fs_dev, pblock);
 }
 
+/*
+ * Search one directory block for dname; bytes is the number of valid
+ * bytes in the block.
+ */
+static const struct ext2_dir_entry *
+ext2_search_block(const char *data, uint32_t bytes,
+		  const char *dname, size_t dname_len)
+{
+    uint32_t offset = 0;
+    const struct ext2_dir_entry *de;
+
+    /* The smallest possible size is 9 bytes */
+    while (offset + 8 < bytes) {
+	de = (const struct ext2_dir_entry *)(data + offset);
+	if (de->d_rec_len < 8 || de->d_rec_len > bytes - offset)
+	    break;
+
+	if (ext2_match_entry(dname, dname_len, de))
+	    return de;
+
+	offset += de->d_rec_len;
+    }
+
+    return NULL;
+}
+
+/*
+ * One level of an htree lookup: the logical block of an index node,
+ * where its dx_entry array starts, and the entry we followed.
+ */
+struct ext2_dx_frame {
+    block_t block;
+    uint32_t offset;
+    uint32_t count;
+    uint32_t at;
+};
+
+static const struct ext2_dx_entry *
+ext2_dx_entries(struct inode *inode, const struct ext2_dx_frame *frame)
+{
+    const char *data = ext2_get_cache(inode, frame->block);
+    return (const struct ext2_dx_entry *)(data + frame->offset);
+}
+
+/*
+ * Read the index node described by frame and find the entry covering
+ * hash.  Returns false if the node doesn't look like an index node.
+ */
+static bool ext2_dx_probe(struct inode *inode, struct ext2_dx_frame *frame,
+			  uint32_t hash)
+{
+    struct fs_info *fs = inode->fs;
+    const struct ext2_dx_entry *entries = ext2_dx_entries(inode, frame);
+    const struct ext2_dx_countlimit *cl =
+	(const struct ext2_dx_countlimit *)entries;
+    uint32_t lo, hi, mid;
+
+    if (!cl->count || cl->count > cl->limit ||
+	frame->offset + cl->limit * sizeof *entries > BLOCK_SIZE(fs))
+	return false;
+    frame->count = cl->count;
+
+    /* Find the last entry whose hash is <= hash; entry 0 has none */
+    lo = 1;
+    hi = frame->count;
+    while (lo < hi) {
+	mid = lo + ((hi - lo) >> 1);
+	if (entries[mid].hash > hash)
+	    hi = mid;
+	else
+	    lo = mid + 1;
+    }
+    frame->at = lo - 1;
+
+    return true;
+}
+
+/*
+ * Look up dname through the htree index of an indexed directory.
+ * Only the leaf blocks the hash selects are scanned.  Sets *bad and
+ * returns NULL if the index can't be used, so the caller can fall back
+ * to a linear scan.
+ */
+static const struct ext2_dir_entry *
+ext2_dx_find_entry(struct fs_info *fs, struct inode *inode,
+		   const char *dname, size_t dname_len, bool *bad)
+{
+    struct ext2_sb_info *sbi = EXT2_SB(fs);
+    struct ext2_dx_frame frames[EXT2_DX_MAX_LEVELS];
+    const struct ext2_dx_root *root;
+    const struct ext2_dx_entry *entries;
+    const struct ext2_dir_entry *de;
+    block_t nblocks = inode->size >> fs->block_shift;
+    block_t leaf;
+    uint32_t hash;
+    int version, levels, level;
+
+    *bad = true;
+
+    root = ext2_get_cache(inode, 0);
+    if (root->info.reserved_zero || root->info.info_length < 8 ||
+	root->info.indirect_levels >= EXT2_DX_MAX_LEVELS)
+	return NULL;
+
+    version = root->info.hash_version;
+    if (version <= EXT2_DX_HASH_TEA)
+	version += sbi->s_hash_unsigned;
+    if (!ext2_dirhash(dname, dname_len, version, sbi->s_hash_seed, &hash))
+	return NULL;
+
+    levels = root->info.indirect_levels + 1;
+    frames[0].block  = 0;
+    frames[0].offset = offsetof(struct ext2_dx_root, info) +
+	root->info.info_length;
+
+    for (level = 0; ; level++) {
+	if (!ext2_dx_probe(inode, &frames[level], hash))
+	    return NULL;
+
+	entries = ext2_dx_entries(inode, &frames[level]);
+	leaf = entries[frames[level].at].block & EXT2_DX_BLOCK_MASK;
+	if (leaf >= nblocks)
+	    return NULL;
+
+	if (level == levels - 1)
+	    break;
+
+	frames[level+1].block  = leaf;
+	frames[level+1].offset = EXT2_DX_NODE_OFFSET;
+    }
+
+    *bad = false;
+
+    for (;;) {
+	de = ext2_search_block(ext2_get_cache(inode, leaf), BLOCK_SIZE(fs),
+			       dname, dname_len);
+	if (de)
+	    return de;
+
+	/*
+	 * Entries with colliding hashes may spill into the next leaf,
+	 * in which case its index entry carries the same hash.  Step
+	 * to the next entry at the lowest level that has one.
+	 */
+	for (level = levels - 1; ; level--) {
+	    if (++frames[level].at < frames[level].count)
+		break;
+	    if (!level)
+		return NULL;
+	}
+
+	entries = ext2_dx_entries(inode, &frames[level]);
+	if ((entries[frames[level].at].hash & ~1) != hash)
+	    return NULL;
+
+	/* Descend along the leftmost edge to the next leaf */
+	for (;;) {
+	    leaf = entries[frames[level].at].block & EXT2_DX_BLOCK_MASK;
+	    if (leaf >= nblocks)
+		return NULL;
+	    if (level == levels - 1)
+		break;
+
+	    level++;
+	    frames[level].block  = leaf;
+	    frames[level].offset = EXT2_DX_NODE_OFFSET;
+	    if (!ext2_dx_probe(inode, &frames[level], 0))
+		return NULL;
+	    frames[level].at = 0;
+	    entries = ext2_dx_entries(inode, &frames[level]);
+	}
+    }
+}
+
 /*
  * find a dir entry, return it if found, or return NULL.
  */
@@ -92,27 +281,28 @@ static const struct ext2_dir_entry *
 ext2_find_entry(struct fs_info *fs, struct inode *inode, const char *dname)
 {
     block_t index = 0;
-    uint32_t i = 0, offset, maxoffset;
+    uint32_t i = 0;
     const struct ext2_dir_entry *de;
-    const char *data;
     size_t dname_len = strlen(dname);
+    bool bad;
+
+    /* "." and ".." live in block 0 and aren't in the index */
+    if (EXT2_SB(fs)->s_dir_index && (inode->flags & EXT2_INDEX_FL) &&
+	strcmp(dname, ".") && strcmp(dname, "..")) {
+	de = ext2_dx_find_entry(fs, inode, dname, dname_len, &bad);
+	if (!bad)
+	    return de;
+	dprintf("ext2: bad htree index in inode %u, scanning\n",
+		(unsigned int)inode->ino);
+    }
 
     while (i < inode->size) {
-	data = ext2_get_cache(inode, index++);
-	offset = 0;
-	maxoffset =  min(BLOCK_SIZE(fs), i-inode->size);
-
-	/* The smallest possible size is 9 bytes */
-	while (offset < maxoffset-8) {
-	    de = (const struct ext2_dir_entry *)(data + offset);
-	    if (de->d_rec_len > maxoffset - offset)
-		break;
-
-	    if (ext2_match_entry(dname, dname_len, de))
-		return de;
+	de = ext2_search_block(ext2_get_cache(inode, index++),
+			       min(BLOCK_SIZE(fs), inode->size - i),
+			       dname, dname_len);
+	if (de)
+	    return de;
 
-	    offset += de->d_rec_len;
-	}
 	i += BLOCK_SIZE(fs);
     }
 
@@ -122,26 +312,29 @@ ext2_find_entry(struct fs_info *fs, struct inode *inode, const char *dname)
 static const struct ext2_inode *
 ext2_get_inode(struct fs_info *fs, int inr)
 {
-    const struct ext2_group_desc *desc;
+    struct ext2_sb_info *sbi = EXT2_SB(fs);
     const char *data;
     uint32_t inode_group, inode_offset;
-    uint32_t block_num, block_off;
+    uint32_t block_off;
+    block_t block_num;
 
     inr--;
     inode_group  = inr / EXT2_INODES_PER_GROUP(fs);
     inode_offset = inr % EXT2_INODES_PER_GROUP(fs);
-    desc = ext2_get_group_desc(fs, inode_group);
-    if (!desc)
+    if (inode_group >= sbi->s_groups_count) {
+	printf("ext2_get_inode: inode %d beyond group count %u\n",
+	       inr + 1, sbi->s_groups_count);
 	return NULL;
+    }
 
-    block_num = desc->bg_inode_table +
+    block_num = sbi->s_inode_table[inode_group] +
 	inode_offset / EXT2_INODES_PER_BLOCK(fs);
     block_off = inode_offset % EXT2_INODES_PER_BLOCK(fs);
 
     data = get_cache(fs->fs_dev, block_num);
 
     return (const struct ext2_inode *)
-	(data + block_off * EXT2_SB(fs)->s_inode_size);
+	(data + block_off * sbi->s_inode_size);
 }
 
 static void fill_inode(struct inode *inode, const struct ext2_inode *e_inode)
@@ -174,6 +367,11 @@ static struct inode *ext2_iget_by_inr(struct fs_info *fs, uint32_t inr)
     return inode;
 }
 
+static void ext2_free_inode(struct inode *inode)
+{
+    free(PVT(inode)->e_leaf);
+}
+
 static struct inode *ext2_iget_root(struct fs_info *fs)
 {
     return ext2_iget_by_inr(fs, EXT2_ROOT_INO);
@@ -315,12 +513,21 @@ static int ext2_fs_init(struct fs_info *fs)
     /* Volume UUID */
     memcpy(sbi->s_uuid, sb.s_uuid, sizeof(sbi->s_uuid));
 
+    /* Directory index */
+    sbi->s_dir_index = !!(sb.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX);
+    sbi->s_hash_unsigned = (sb.s_flags & EXT2_FLAGS_UNSIGNED_HASH) ?
+	EXT2_DX_HASH_LEGACY_UNSIGNED : 0;
+    memcpy(sbi->s_hash_seed, sb.s_hash_seed, sizeof(sbi->s_hash_seed));
+
     /* Initialize the cache, and force block zero to all zero */
     cache_init(fs->fs_dev, fs->block_shift);
     cs = _get_cache_block(fs->fs_dev, 0);
     memset(cs->data, 0, fs->block_size);
     cache_lock_block(cs);
 
+    if (ext2_read_group_descs(fs, &sb))
+	return -1;
+
     return fs->block_shift;
 }
 
@@ -361,7 +568,7 @@ static char *ext2_fs_uuid(struct fs_info *fs)
 
 const struct fs_ops ext2_fs_ops = {
     .fs_name       = "ext2",
-    .fs_flags      = FS_THISIND | FS_USEMEM,
+    .fs_flags      = FS_THISIND | FS_USEMEM | FS_SEEKABLE,
     .fs_init       = ext2_fs_init,
     .searchdir     = NULL,
     .getfssec      = generic_getfssec,
@@ -371,6 +578,7 @@ const struct fs_ops ext2_fs_ops = {
     .open_config   = generic_open_config,
     .iget_root     = ext2_iget_root,
     .iget          = ext2_iget,
+    .free_inode    = ext2_free_inode,
     .readlink      = ext2_readlink,
     .readdir       = ext2_readdir,
     .next_extent   = ext2_next_extent,
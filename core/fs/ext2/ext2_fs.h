@@ -2,6 +2,7 @@
 #define __EXT2_FS_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define	EXT2_SUPER_MAGIC	0xEF53
 
@@ -23,8 +24,18 @@
 #define EXT3_FEATURE_INCOMPAT_RECOVER		0x0004
 #define EXT3_FEATURE_INCOMPAT_JOURNAL_DEV	0x0008
 #define EXT2_FEATURE_INCOMPAT_META_BG		0x0010
+#define EXT4_FEATURE_INCOMPAT_64BIT		0x0080
 #define EXT2_FEATURE_INCOMPAT_ANY		0xffffffff
 
+// ...but the directory index is a compat feature.
+#define EXT2_FEATURE_COMPAT_DIR_INDEX		0x0020
+
+// Superblock s_flags
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
+// Inode i_flags
+#define EXT2_INDEX_FL		0x00001000	// Hash-indexed directory
+
 #define EXT2_NDIR_BLOCKS	12
 #define	EXT2_IND_BLOCK		EXT2_NDIR_BLOCKS
 #define EXT2_DIND_BLOCK		(EXT2_IND_BLOCK+1)
@@ -35,6 +46,7 @@
 /* for EXT4 extent */
 #define EXT4_EXT_MAGIC     0xf30a
 #define EXT4_EXTENTS_FLAG  0x00080000
+#define EXT4_INIT_MAX_LEN  32768	/* Longer ee_len means unwritten */
 
 /*
  * File types and file modes
@@ -160,6 +172,26 @@ struct ext2_group_desc {
     uint32_t bg_reserved[3];
 };
 
+/*
+ * The second half of a 64-byte group descriptor, present when the
+ * 64bit feature is set and s_desc_size >= 64
+ */
+#define EXT4_MIN_DESC_SIZE_64BIT	64
+
+struct ext4_group_desc_hi {
+    uint32_t bg_block_bitmap_hi;	/* Blocks bitmap block MSB */
+    uint32_t bg_inode_bitmap_hi;	/* Inodes bitmap block MSB */
+    uint32_t bg_inode_table_hi;		/* Inodes table block MSB */
+    uint16_t bg_free_blocks_count_hi;
+    uint16_t bg_free_inodes_count_hi;
+    uint16_t bg_used_dirs_count_hi;
+    uint16_t bg_itable_unused_hi;
+    uint32_t bg_exclude_bitmap_hi;
+    uint16_t bg_block_bitmap_csum_hi;
+    uint16_t bg_inode_bitmap_csum_hi;
+    uint32_t bg_reserved;
+};
+
 /*******************************************************************************
 #ifndef DEPEND
 #if ext2_group_desc_size != 32
@@ -262,9 +294,62 @@ struct ext4_extent_header {
 
 
 
+/*
+ * Hash-indexed (htree) directories.  Block 0 holds the "." and ".."
+ * entries followed by the dx_root_info and the root dx_entry array;
+ * interior nodes are blocks holding a single empty dirent covering the
+ * whole block, followed by a dx_entry array.  The first dx_entry of
+ * each array has its hash field replaced by the limit/count pair.
+ */
+#define EXT2_DX_HASH_LEGACY		0
+#define EXT2_DX_HASH_HALF_MD4		1
+#define EXT2_DX_HASH_TEA		2
+#define EXT2_DX_HASH_LEGACY_UNSIGNED	3
+#define EXT2_DX_HASH_HALF_MD4_UNSIGNED	4
+#define EXT2_DX_HASH_TEA_UNSIGNED	5
+
+#define EXT2_HTREE_EOF		0x7fffffff
+#define EXT2_DX_MAX_LEVELS	3
+#define EXT2_DX_BLOCK_MASK	0x0fffffff
+
+struct ext2_dx_root_info {
+    uint32_t reserved_zero;
+    uint8_t  hash_version;
+    uint8_t  info_length;	/* 8 */
+    uint8_t  indirect_levels;
+    uint8_t  unused_flags;
+};
+
+struct ext2_dx_root {
+    uint8_t  dot[12];		/* "." dirent */
+    uint8_t  dotdot[12];	/* ".." dirent, covers the rest of the block */
+    struct ext2_dx_root_info info;
+};
+
+struct ext2_dx_countlimit {
+    uint16_t limit;
+    uint16_t count;
+};
+
+struct ext2_dx_entry {
+    uint32_t hash;
+    uint32_t block;
+};
+
+#define EXT2_DX_NODE_OFFSET	8	/* Size of the empty dirent in a node */
+
 #define EXT4_FIRST_EXTENT(header) ( (struct ext4_extent *)(header + 1) )
 #define EXT4_FIRST_INDEX(header)  ( (struct ext4_extent_idx *) (header + 1) )
 
+/*
+ * An extent as kept in the in-memory leaf cache
+ */
+struct ext2_extent {
+    uint32_t lblock;		/* First logical block */
+    uint32_t len;		/* Number of blocks */
+    block_t  pblock;		/* First physical block, 0 if unwritten */
+};
+
 
 /*
  * The ext2 super block information in memory
@@ -276,8 +361,12 @@ struct ext2_sb_info {
     uint32_t s_desc_per_block;  /* Number of group descriptors per block */
     uint32_t s_groups_count;    /* Number of groups in the fs */
     uint32_t s_first_data_block;	/* First Data Block */
+    block_t  *s_inode_table;	/* Inode table block of each group */
     int      s_inode_size;
     uint8_t  s_uuid[16];	/* 128-bit uuid for volume */
+    bool     s_dir_index;	/* Hash-indexed directories may exist */
+    uint8_t  s_hash_unsigned;	/* 3 if the htree hash uses unsigned char */
+    uint32_t s_hash_seed[4];	/* HTREE hash seed */
 };
 
 static inline struct ext2_sb_info *EXT2_SB(struct fs_info *fs)
@@ -298,6 +387,12 @@ struct ext2_pvt_inode {
 	uint32_t i_block[EXT2_N_BLOCKS];
 	struct ext4_extent_header i_extent_hdr;
     };
+    /* Decoded copy of the extent leaf last used, see bmap.c */
+    struct ext2_extent *e_leaf;
+    uint16_t e_count;		/* Extents in e_leaf */
+    uint16_t e_alloc;		/* Extents allocated */
+    uint32_t e_start;		/* Logical blocks covered by the leaf */
+    uint32_t e_end;
 };
 
 #define PVT(i) ((struct ext2_pvt_inode *)((i)->pvt))
@@ -307,5 +402,6 @@ struct ext2_pvt_inode {
  */
 block_t ext2_bmap(struct inode *, block_t, size_t *);
 int ext2_next_extent(struct inode *, uint32_t);
+bool ext2_dirhash(const char *, int, int, const uint32_t *, uint32_t *);
 
 #endif /* ext2_fs.h */
@@ -0,0 +1,206 @@
+/*
+ * Directory index (htree) hash functions, as used by ext3/ext4 to
+ * order the entries of indexed directories.  These must produce
+ * exactly the values the kernel stores on disk.
+ *
+ * Based on fs/ext4/hash.c from the Linux kernel,
+ * Copyright (C) 2002 by Theodore Ts'o.  This file may be redistributed
+ * under the terms of the GNU Public License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fs.h>
+#include "ext2_fs.h"
+
+#define DELTA 0x9E3779B9
+
+static void tea_transform(uint32_t buf[2], const uint32_t in[4])
+{
+    uint32_t sum = 0;
+    uint32_t b0 = buf[0], b1 = buf[1];
+    uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+    int n = 16;
+
+    do {
+	sum += DELTA;
+	b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+	b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    } while (--n);
+
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+static inline uint32_t rol32(uint32_t x, int s)
+{
+    return (x << s) | (x >> (32 - s));
+}
+
+/* F, G and H are basic MD4 functions: selection, majority, parity */
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+
+#define ROUND(f, a, b, c, d, x, s) \
+    (a += f(b, c, d) + x, a = rol32(a, s))
+#define K1 0
+#define K2 013240474631U
+#define K3 015666365641U
+
+/*
+ * Basic cut-down MD4 transform.
+ */
+static void half_md4_transform(uint32_t buf[4], const uint32_t in[8])
+{
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    /* Round 1 */
+    ROUND(F, a, b, c, d, in[0] + K1,  3);
+    ROUND(F, d, a, b, c, in[1] + K1,  7);
+    ROUND(F, c, d, a, b, in[2] + K1, 11);
+    ROUND(F, b, c, d, a, in[3] + K1, 19);
+    ROUND(F, a, b, c, d, in[4] + K1,  3);
+    ROUND(F, d, a, b, c, in[5] + K1,  7);
+    ROUND(F, c, d, a, b, in[6] + K1, 11);
+    ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+    /* Round 2 */
+    ROUND(G, a, b, c, d, in[1] + K2,  3);
+    ROUND(G, d, a, b, c, in[3] + K2,  5);
+    ROUND(G, c, d, a, b, in[5] + K2,  9);
+    ROUND(G, b, c, d, a, in[7] + K2, 13);
+    ROUND(G, a, b, c, d, in[0] + K2,  3);
+    ROUND(G, d, a, b, c, in[2] + K2,  5);
+    ROUND(G, c, d, a, b, in[4] + K2,  9);
+    ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+    /* Round 3 */
+    ROUND(H, a, b, c, d, in[3] + K3,  3);
+    ROUND(H, d, a, b, c, in[7] + K3,  9);
+    ROUND(H, c, d, a, b, in[2] + K3, 11);
+    ROUND(H, b, c, d, a, in[6] + K3, 15);
+    ROUND(H, a, b, c, d, in[1] + K3,  3);
+    ROUND(H, d, a, b, c, in[5] + K3,  9);
+    ROUND(H, c, d, a, b, in[0] + K3, 11);
+    ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+#undef F
+#undef G
+#undef H
+#undef ROUND
+
+/* The old legacy hash */
+static uint32_t dx_hack_hash(const char *name, int len, bool is_unsigned)
+{
+    uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+    int c;
+
+    while (len--) {
+	c = is_unsigned ? (int)(unsigned char)*name : (int)(signed char)*name;
+	name++;
+	hash = hash1 + (hash0 ^ (c * 7152373));
+
+	if (hash & 0x80000000)
+	    hash -= 0x7fffffff;
+	hash1 = hash0;
+	hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+static void str2hashbuf(const char *msg, int len, uint32_t *buf, int num,
+			bool is_unsigned)
+{
+    uint32_t pad, val;
+    int i, c;
+
+    pad = (uint32_t)len | ((uint32_t)len << 8);
+    pad |= pad << 16;
+
+    val = pad;
+    if (len > num * 4)
+	len = num * 4;
+    for (i = 0; i < len; i++) {
+	c = is_unsigned ? (int)(unsigned char)msg[i] : (int)(signed char)msg[i];
+	val = c + (val << 8);
+	if ((i % 4) == 3) {
+	    *buf++ = val;
+	    val = pad;
+	    num--;
+	}
+    }
+    if (--num >= 0)
+	*buf++ = val;
+    while (--num >= 0)
+	*buf++ = pad;
+}
+
+/*
+ * Compute the htree hash of a name.  version is one of the
+ * EXT2_DX_HASH_* values, already adjusted for unsigned char
+ * filesystems.  Returns false if the hash version is unknown.
+ */
+bool ext2_dirhash(const char *name, int len, int version,
+		  const uint32_t *seed, uint32_t *hashp)
+{
+    uint32_t hash;
+    uint32_t buf[4];
+    uint32_t in[8];
+    bool is_unsigned = version >= EXT2_DX_HASH_LEGACY_UNSIGNED;
+    const char *p;
+    int i;
+
+    /* Initialize the default seed for the hash checksum functions */
+    buf[0] = 0x67452301;
+    buf[1] = 0xefcdab89;
+    buf[2] = 0x98badcfe;
+    buf[3] = 0x10325476;
+
+    /* An all-zero seed means "use the default" */
+    for (i = 0; i < 4; i++) {
+	if (seed[i]) {
+	    memcpy(buf, seed, sizeof buf);
+	    break;
+	}
+    }
+
+    switch (version) {
+    case EXT2_DX_HASH_LEGACY:
+    case EXT2_DX_HASH_LEGACY_UNSIGNED:
+	hash = dx_hack_hash(name, len, is_unsigned);
+	break;
+    case EXT2_DX_HASH_HALF_MD4:
+    case EXT2_DX_HASH_HALF_MD4_UNSIGNED:
+	for (p = name; len > 0; len -= 32, p += 32) {
+	    str2hashbuf(p, len, in, 8, is_unsigned);
+	    half_md4_transform(buf, in);
+	}
+	hash = buf[1];
+	break;
+    case EXT2_DX_HASH_TEA:
+    case EXT2_DX_HASH_TEA_UNSIGNED:
+	for (p = name; len > 0; len -= 16, p += 16) {
+	    str2hashbuf(p, len, in, 4, is_unsigned);
+	    tea_transform(buf, in);
+	}
+	hash = buf[0];
+	break;
+    default:
+	return false;
+    }
+
+    hash &= ~1;
+    if (hash == (EXT2_HTREE_EOF << 1))
+	hash = (EXT2_HTREE_EOF - 1) << 1;
+
+    *hashp = hash;
+    return true;
+}
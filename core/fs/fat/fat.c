@@ -9,9 +9,12 @@
 #include <fs.h>
 #include <ilog2.h>
 #include <klibc/compiler.h>
+#include <minmax.h>
 #include "codepage.h"
 #include "fat_fs.h"
 
+#define FAT32_MASK	0x0fffffff	/* The top 4 bits are reserved */
+
 static struct inode * new_fat_inode(struct fs_info *fs)
 {
     struct inode *inode = alloc_inode(fs, 0, sizeof(struct fat_pvt_inode));
@@ -77,66 +80,202 @@ static uint32_t get_next_cluster(struct fs_info *fs, uint32_t clust_num)
 	offset &= sector_mask;
 	data = get_fat_sector(fs, fat_sector);
 	next_cluster = *(const uint32_t *)(data + offset);
-	next_cluster &= 0x0fffffff;
+	next_cluster &= FAT32_MASK;
 	break;
     }
 
     return next_cluster;
 }
 
+/*
+ * Return how many of the n FAT32 entries at fat[] hold next, next+1,
+ * next+2, ..., i.e. how far a contiguous run continues through them.
+ *
+ * Where SSE2 is part of the base instruction set (x86-64) this
+ * compares four entries at a time; otherwise four are folded into one
+ * test with scalar operations.
+ */
+static uint32_t fat32_scan_run(const uint32_t *fat, uint32_t n, uint32_t next)
+{
+    uint32_t i = 0;
+
+#ifdef __SSE2__
+    typedef uint32_t v4u32 __attribute__((vector_size(16), aligned(4)));
+    const v4u32 mask = { FAT32_MASK, FAT32_MASK, FAT32_MASK, FAT32_MASK };
+    const v4u32 step = { 4, 4, 4, 4 };
+    v4u32 expect = { next, next + 1, next + 2, next + 3 };
+    v4u32 diff;
+
+    for (; i + 4 <= n; i += 4) {
+	diff = (*(const v4u32 *)(fat + i) ^ expect) & mask;
+	if (diff[0] | diff[1] | diff[2] | diff[3])
+	    break;
+	expect += step;
+    }
+#else
+    for (; i + 4 <= n; i += 4) {
+	if (((fat[i]   ^ (next + i))     |
+	     (fat[i+1] ^ (next + i + 1)) |
+	     (fat[i+2] ^ (next + i + 2)) |
+	     (fat[i+3] ^ (next + i + 3))) & FAT32_MASK)
+	    break;
+    }
+#endif
+
+    /* Find the exact end within the last group, and any tail */
+    for (; i < n; i++) {
+	if ((fat[i] & FAT32_MASK) != next + i)
+	    break;
+    }
+
+    return i;
+}
+
+/*
+ * Count how many clusters, starting at cluster, follow each other
+ * contiguously in the chain, up to max.  *next gets the FAT entry of
+ * the last one, i.e. the cluster after the run.
+ *
+ * For FAT16 and FAT32 this works on a whole FAT sector at a time
+ * rather than going through get_next_cluster() for every entry.
+ */
+static uint32_t fat_run_length(struct fs_info *fs, uint32_t cluster,
+			       uint32_t max, uint32_t *next)
+{
+    struct fat_sb_info *sbi = FAT_SB(fs);
+    uint32_t len = 0;
+    uint32_t entry;
+
+    /* Don't run off the end of the FAT */
+    max = min(max, sbi->clusters + 2 - cluster);
+
+    if (sbi->fat_type == FAT12) {
+	do {
+	    entry = get_next_cluster(fs, cluster + len);
+	} while (++len < max && entry == cluster + len);
+
+	*next = entry;
+	return len;
+    }
+
+    for (;;) {
+	uint32_t c = cluster + len;
+	int shift = sbi->fat_type == FAT32 ? 2 : 1;
+	uint32_t per_sector = SECTOR_SIZE(fs) >> shift;
+	uint32_t i = c & (per_sector - 1);
+	const void *data = get_fat_sector(fs, (sector_t)c >> (SECTOR_SHIFT(fs) - shift));
+
+	if (shift == 2) {
+	    const uint32_t *fat = data;
+	    uint32_t n = min(per_sector - i, max - len);
+	    uint32_t k = fat32_scan_run(fat + i, n, c + 1);
+
+	    if (k < n) {
+		/* Entry i+k ends the run */
+		*next = fat[i+k] & FAT32_MASK;
+		return len + k + 1;
+	    }
+
+	    len += k;
+	    if (len >= max) {
+		*next = fat[i+k-1] & FAT32_MASK;
+		return len;
+	    }
+	    continue;
+	}
+
+	for (; i < per_sector; i++) {
+	    entry = ((const uint16_t *)data)[i];
+
+	    if (++len >= max || entry != cluster + len) {
+		*next = entry;
+		return len;
+	    }
+	}
+    }
+}
+
+/*
+ * Extend the inode's cluster chain map by one run.  Returns -1 if the
+ * chain ends (or is broken) before the end of the file; the file size
+ * is then trimmed to what the chain actually covers.
+ */
+static int fat_map_run(struct inode *inode, uint32_t tcluster)
+{
+    struct fs_info *fs = inode->fs;
+    struct fat_sb_info *sbi = FAT_SB(fs);
+    struct fat_pvt_inode *pvt = PVT(inode);
+    struct fat_run *run;
+    uint32_t pcluster;
+
+    pcluster = pvt->nruns ? pvt->next_cluster : pvt->start_cluster;
+    if (pcluster - 2 >= sbi->clusters) {
+	inode->size = (uint64_t)pvt->mapped << sbi->clust_byte_shift;
+	return -1;
+    }
+
+    if (pvt->nruns == pvt->runs_alloc) {
+	uint32_t alloc = pvt->runs_alloc ? pvt->runs_alloc << 1 : 4;
+
+	run = realloc(pvt->runs, alloc * sizeof *run);
+	if (!run)
+	    return -1;
+	pvt->runs = run;
+	pvt->runs_alloc = alloc;
+    }
+
+    run = &pvt->runs[pvt->nruns++];
+    run->lcluster = pvt->mapped;
+    run->pcluster = pcluster;
+    run->len = fat_run_length(fs, pcluster, tcluster - pvt->mapped,
+			      &pvt->next_cluster);
+    pvt->mapped += run->len;
+
+    return 0;
+}
+
+/*
+ * The cluster chain is mapped into runs of contiguous clusters as far
+ * as it is needed, so any position in the file, forwards or backwards,
+ * is found with a binary search rather than by following the chain
+ * from the start.
+ */
 static int fat_next_extent(struct inode *inode, uint32_t lstart)
 {
     struct fs_info *fs = inode->fs;
     struct fat_sb_info *sbi = FAT_SB(fs);
+    struct fat_pvt_inode *pvt = PVT(inode);
     uint32_t mcluster = lstart >> sbi->clust_shift;
-    uint32_t lcluster;
-    uint32_t pcluster;
     uint32_t tcluster;
-    uint32_t xcluster;
     const uint32_t cluster_bytes = UINT32_C(1) << sbi->clust_byte_shift;
-    const uint32_t cluster_secs  = UINT32_C(1) << sbi->clust_shift;
-    sector_t data_area = sbi->data;
+    const struct fat_run *run;
+    uint32_t lo, hi, mid, skip;
 
     tcluster = (inode->size + cluster_bytes - 1) >> sbi->clust_byte_shift;
     if (mcluster >= tcluster)
 	goto err;		/* Requested cluster beyond end of file */
 
-    lcluster = PVT(inode)->offset >> sbi->clust_shift;
-    pcluster = ((PVT(inode)->here - data_area) >> sbi->clust_shift) + 2;
-
-    if (lcluster > mcluster || PVT(inode)->here < data_area) {
-	lcluster = 0;
-	pcluster = PVT(inode)->start_cluster;
-    }
-
-    for (;;) {
-	if (pcluster-2 >= sbi->clusters) {
-	    inode->size = lcluster << sbi->clust_shift;
+    while (pvt->mapped <= mcluster) {
+	if (fat_map_run(inode, tcluster))
 	    goto err;
-	}
-
-	if (lcluster >= mcluster)
-	    break;
-
-	lcluster++;
-	pcluster = get_next_cluster(fs, pcluster);
     }
 
-    inode->next_extent.pstart =
-	((sector_t)(pcluster-2) << sbi->clust_shift) + data_area;
-    inode->next_extent.len = cluster_secs;
-    xcluster = 0;		/* Nonsense */
-
-    while (++lcluster < tcluster) {
-	xcluster = get_next_cluster(fs, pcluster);
-	if (xcluster != ++pcluster)
-	    break;		/* Not contiguous */
-	inode->next_extent.len += cluster_secs;
+    /* Find the last run starting at or before mcluster */
+    lo = 0;
+    hi = pvt->nruns;
+    while (hi - lo > 1) {
+	mid = (lo + hi) >> 1;
+	if (pvt->runs[mid].lcluster > mcluster)
+	    hi = mid;
+	else
+	    lo = mid;
     }
+    run = &pvt->runs[lo];
 
-    /* Note: ->here is bogus if ->offset >= EOF, but that's okay */
-    PVT(inode)->offset = lcluster << sbi->clust_shift;
-    PVT(inode)->here   = ((xcluster-2) << sbi->clust_shift) + data_area;
+    skip = lstart - (run->lcluster << sbi->clust_shift);
+    inode->next_extent.pstart =
+	((sector_t)(run->pcluster-2) << sbi->clust_shift) + sbi->data + skip;
+    inode->next_extent.len = (run->len << sbi->clust_shift) - skip;
 
     return 0;
 
@@ -145,6 +284,11 @@ err:
     return -1;
 }
 
+static void fat_free_inode(struct inode *inode)
+{
+    free(PVT(inode)->runs);
+}
+
 static sector_t get_next_sector(struct fs_info* fs, uint32_t sector)
 {
     struct fat_sb_info *sbi = FAT_SB(fs);
@@ -843,7 +987,7 @@ static char *vfat_fs_uuid(struct fs_info *fs)
 
 const struct fs_ops vfat_fs_ops = {
     .fs_name       = "vfat",
-    .fs_flags      = FS_USEMEM | FS_THISIND,
+    .fs_flags      = FS_USEMEM | FS_THISIND | FS_SEEKABLE,
     .fs_init       = vfat_fs_init,
     .searchdir     = NULL,
     .getfssec      = generic_getfssec,
@@ -854,6 +998,7 @@ const struct fs_ops vfat_fs_ops = {
     .readdir       = vfat_readdir,
     .iget_root     = vfat_iget_root,
     .iget          = vfat_iget,
+    .free_inode    = fat_free_inode,
     .next_extent   = fat_next_extent,
     .copy_super    = vfat_copy_superblock,
     .fs_uuid       = vfat_fs_uuid,
@@ -148,11 +148,27 @@ static inline int root_dir_size(struct fs_info *fs, struct fat_bpb *fat)
 /*
  * FAT private inode information
  */
+/*
+ * A run of contiguous clusters in a cluster chain
+ */
+struct fat_run {
+    uint32_t lcluster;		/* First logical cluster in the file */
+    uint32_t pcluster;		/* First cluster on disk */
+    uint32_t len;		/* Number of clusters */
+};
+
 struct fat_pvt_inode {
     uint32_t start_cluster;	/* Starting cluster address */
     sector_t start;		/* Starting sector */
     sector_t offset;		/* Current sector offset */
     sector_t here;		/* Sector corresponding to offset */
+
+    /* Cluster chain map, built on demand by fat_next_extent() */
+    struct fat_run *runs;
+    uint32_t nruns;
+    uint32_t runs_alloc;
+    uint32_t mapped;		/* Logical clusters covered by runs[] */
+    uint32_t next_cluster;	/* Cluster following the last run */
 };
 
 #define PVT(i) ((struct fat_pvt_inode *)((i)->pvt))
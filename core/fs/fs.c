@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <dprintf.h>
+#include <minmax.h>
 #include <syslinux/sysappend.h>
 #include "core.h"
 #include "dev.h"
@@ -49,7 +50,7 @@ void put_inode(struct inode *inode)
 	inode = dead->parent;
 	if (dead->name)
 	    free((char *)dead->name);
-	free(dead);
+	free_inode(dead);
     }
 }
 
@@ -138,6 +139,94 @@ size_t pmapi_read_file(uint16_t *handle, void *buf, size_t sectors)
     return bytes_read;
 }
 
+/*
+ * Read from an arbitrary byte offset of an open file into the regions
+ * described by iov[], without moving the file position or closing the
+ * file at EOF.  Whole sectors are read straight into the destination;
+ * only a partial sector at either end of a region is bounced.
+ *
+ * Only filesystems with FS_SEEKABLE support this.  Returns the number
+ * of bytes read, or -1 on error.
+ */
+__export ssize_t pmapi_preadv_file(uint16_t handle, const struct iovec *iov,
+				   int iovcnt, off_t offset)
+{
+    struct file *file = handle_to_file(handle);
+    struct fs_info *fs;
+    uint32_t saved_offset;
+    uint32_t secmask;
+    char *bounce = NULL;
+    ssize_t total = 0;
+    bool have_more;
+
+    if (!file || !file->fs) {
+	errno = EBADF;
+	return -1;
+    }
+
+    fs = file->fs;
+    if (!(fs->fs_ops->fs_flags & FS_SEEKABLE)) {
+	errno = ESPIPE;
+	return -1;
+    }
+
+    /* off_t is unsigned here; a negative offset has the top bit set */
+    if ((ssize_t)offset < 0) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    secmask = SECTOR_SIZE(fs) - 1;
+    saved_offset = file->offset;
+
+    while (iovcnt--) {
+	char *p = iov->iov_base;
+	size_t count = iov->iov_len;
+
+	iov++;
+
+	while (count && offset < file->inode->size) {
+	    uint32_t skip = offset & secmask;
+	    size_t bytes, got;
+
+	    file->offset = offset - skip;
+
+	    if (!skip && count > secmask) {
+		/* Whole sectors, straight into the destination */
+		got = fs->fs_ops->getfssec(file, p, count >> SECTOR_SHIFT(fs),
+					   &have_more);
+		bytes = got;
+	    } else {
+		if (!bounce) {
+		    bounce = malloc(SECTOR_SIZE(fs));
+		    if (!bounce) {
+			errno = ENOMEM;
+			if (!total)
+			    total = -1;
+			goto out;
+		    }
+		}
+		got = fs->fs_ops->getfssec(file, bounce, 1, &have_more);
+		bytes = got > skip ? min(got - skip, count) : 0;
+		memcpy(p, bounce + skip, bytes);
+	    }
+
+	    if (!bytes)
+		goto out;
+
+	    p += bytes;
+	    count -= bytes;
+	    offset += bytes;
+	    total += bytes;
+	}
+    }
+
+out:
+    free(bounce);
+    file->offset = saved_offset;
+    return total;
+}
+
 int searchdir(const char *name, int flags)
 {
     static char root_name[] = "/";
@@ -235,23 +324,38 @@ int searchdir(const char *name, int flags)
 
 	/* Anything else */
 	tmp = inode;
-	inode = this_fs->fs_ops->iget(inode_name, inode);
-	if (!inode) {
-	    /* Failure.  Release the chain */
+	if (dcache_lookup(tmp, inode_name, &inode)) {
+	    /* A cached inode already holds its own reference to tmp */
 	    put_inode(tmp);
-	    break;
-	}
+	    if (!inode)
+		break;
+	} else {
+	    errno = 0;
+	    inode = this_fs->fs_ops->iget(inode_name, tmp);
+	    if (!inode) {
+		/*
+		 * Failure.  Remember it, unless it was for want of
+		 * memory or a disk error rather than because the name
+		 * isn't there, and release the chain
+		 */
+		if (!errno)
+		    dcache_insert(tmp, inode_name, NULL);
+		put_inode(tmp);
+		break;
+	    }
 
-	/* Sanity-check */
-	if (inode->parent && inode->parent != tmp) {
-	    dprintf("searchdir: iget returned a different parent\n");
-	    put_inode(inode);
-	    inode = NULL;
-	    put_inode(tmp);
-	    break;
+	    /* Sanity-check */
+	    if (inode->parent && inode->parent != tmp) {
+		dprintf("searchdir: iget returned a different parent\n");
+		put_inode(inode);
+		inode = NULL;
+		put_inode(tmp);
+		break;
+	    }
+	    inode->parent = tmp;
+	    inode->name = strdup(inode_name);
+	    dcache_insert(tmp, inode_name, inode);
 	}
-	inode->parent = tmp;
-	inode->name = strdup(inode_name);
 	dprintf("searchdir: path component: %s\n", inode->name);
 
 	/* Symlink handling */
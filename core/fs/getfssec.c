@@ -56,38 +56,116 @@
  * and coalescing.  However, if the filesystem can do extent coalescing
  * very cheaply by using filesystem-specific knowledge, then that is
  * preferred (e.g. FAT).
+ *
+ * The coalesced extents are kept in a per-inode extent map, which is
+ * extended as the file is read and reused for any later read of the
+ * same range, so next_extent() is called at most once per extent.
  */
 
 #include <dprintf.h>
 #include <minmax.h>
 #include "fs.h"
 
-static inline sector_t next_psector(sector_t psector, uint32_t skip)
+/* Initial number of extents allocated in an extent map */
+#define EXTENT_MAP_INITIAL	8
+
+/*
+ * Append an extent to the map, coalescing it with the last one if it
+ * is physically contiguous.
+ */
+static int extent_map_add(struct inode *inode, const struct extent *ext)
 {
-    if (EXTENT_SPECIAL(psector))
-	return psector;
-    else
-	return psector + skip;
+    struct extent_map *em = inode->emap;
+    struct extent *last;
+
+    if (em->count) {
+	last = &em->ext[em->count - 1];
+	if (ext->pstart == EXTENT_ZERO ? last->pstart == EXTENT_ZERO :
+	    (!EXTENT_SPECIAL(last->pstart) &&
+	     ext->pstart == last->pstart + last->len)) {
+	    last->len += ext->len;
+	    goto done;
+	}
+    }
+
+    if (em->count == em->alloc) {
+	em = realloc(em, sizeof *em + 2 * em->alloc * sizeof(struct extent));
+	if (!em)
+	    return -1;
+	em->alloc *= 2;
+	inode->emap = em;
+    }
+
+    em->ext[em->count++] = *ext;
+
+done:
+    em->lend = ext->lstart + ext->len;
+    return 0;
 }
 
-static inline sector_t next_pstart(const struct extent *e)
+/*
+ * Extend the extent map of an inode so it covers at least the logical
+ * sectors below _lend_.  The map is built front to back through
+ * next_extent(), in the same order a sequential read would have
+ * called it, so drivers keeping a cursor in inode->next_extent still
+ * see the access pattern they expect.
+ */
+static int extent_map_extend(struct inode *inode, uint32_t lend)
 {
-    return next_psector(e->pstart, e->len);
-}
+    struct extent_map *em = inode->emap;
+
+    if (!em) {
+	em = malloc(sizeof *em + EXTENT_MAP_INITIAL * sizeof(struct extent));
+	if (!em)
+	    return -1;
+	em->count = 0;
+	em->alloc = EXTENT_MAP_INITIAL;
+	em->lend = 0;
+	inode->emap = em;
+
+	/* Filesystems like iso9660 fill in the first extent at iget time */
+	if (inode->next_extent.len && inode->next_extent.lstart == 0 &&
+	    extent_map_add(inode, &inode->next_extent))
+	    return -1;
+    }
 
+    while (inode->emap->lend < lend) {
+	uint32_t lstart = inode->emap->lend;
 
-static void get_next_extent(struct inode *inode)
-{
-    /* The logical start address that we care about... */
-    uint32_t lstart = inode->this_extent.lstart + inode->this_extent.len;
+	if (inode->fs->fs_ops->next_extent(inode, lstart) ||
+	    !inode->next_extent.len)
+	    return -1;
+	inode->next_extent.lstart = lstart;
 
-    if (inode->fs->fs_ops->next_extent(inode, lstart))
-	inode->next_extent.len = 0; /* ERROR */
-    inode->next_extent.lstart = lstart;
+	dprintf("Extent: inode %p @ %u start %llu len %u\n",
+		inode, inode->next_extent.lstart,
+		inode->next_extent.pstart, inode->next_extent.len);
 
-    dprintf("Extent: inode %p @ %u start %llu len %u\n",
-	    inode, inode->next_extent.lstart,
-	    inode->next_extent.pstart, inode->next_extent.len);
+	if (extent_map_add(inode, &inode->next_extent))
+	    return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Find the extent in the map containing logical sector _lsector_,
+ * which must already be mapped.
+ */
+static const struct extent *extent_map_find(const struct extent_map *em,
+					    uint32_t lsector)
+{
+    uint32_t lo = 0, hi = em->count - 1, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi + 1) >> 1;
+	if (em->ext[mid].lstart <= lsector)
+	    lo = mid;
+	else
+	    hi = mid - 1;
+    }
+
+    return &em->ext[lo];
 }
 
 uint32_t generic_getfssec(struct file *file, char *buf,
@@ -111,82 +189,38 @@ uint32_t generic_getfssec(struct file *file, char *buf,
     lsector = file->offset >> SECTOR_SHIFT(fs);
     dprintf("Offset: %u  lsector: %u\n", file->offset, lsector);
 
-    if (lsector < inode->this_extent.lstart ||
-	lsector >= inode->this_extent.lstart + inode->this_extent.len) {
-	/* inode->this_extent unusable, maybe next_extent is... */
-	inode->this_extent = inode->next_extent;
+    /*
+     * Map the whole request up front; if that fails part way, read
+     * whatever could be mapped.
+     */
+    if (extent_map_extend(inode, lsector + sectors)) {
+	if (!inode->emap || inode->emap->lend <= lsector)
+	    sectors = 0; /* Failed to get anything... we're dead */
+	else
+	    sectors = min((uint32_t)sectors, inode->emap->lend - lsector);
     }
 
-    if (lsector < inode->this_extent.lstart ||
-	lsector >= inode->this_extent.lstart + inode->this_extent.len) {
-	/* Still nothing useful... */
-	inode->this_extent.lstart = lsector;
-	inode->this_extent.len = 0;
-    } else {
-	/* We have some usable information */
-	uint32_t delta = lsector - inode->this_extent.lstart;
-	inode->this_extent.lstart = lsector;
-	inode->this_extent.len -= delta;
-	inode->this_extent.pstart
-	    = next_psector(inode->this_extent.pstart, delta);
-    }
-
-    dprintf("this_extent: lstart %u pstart %llu len %u\n",
-	    inode->this_extent.lstart,
-	    inode->this_extent.pstart,
-	    inode->this_extent.len);
-
     while (sectors) {
+	const struct extent *ext = extent_map_find(inode->emap, lsector);
+	uint32_t delta = lsector - ext->lstart;
 	uint32_t chunk;
 	size_t len;
 
-	while (sectors > inode->this_extent.len) {
-	    if (!inode->next_extent.len ||
-		inode->next_extent.lstart !=
-		inode->this_extent.lstart + inode->this_extent.len)
-		get_next_extent(inode);
-
-	    if (!inode->this_extent.len) {
-		/* Doesn't matter if it's contiguous... */
-		inode->this_extent = inode->next_extent;
-		if (!inode->next_extent.len) {
-		    sectors = 0; /* Failed to get anything... we're dead */
-		    break;
-		}
-	    } else if (inode->next_extent.len &&
-		inode->next_extent.pstart == next_pstart(&inode->this_extent)) {
-		/* Coalesce extents and loop */
-		inode->this_extent.len += inode->next_extent.len;
-	    } else {
-		/* Discontiguous extents */
-		break;
-	    }
-	}
-
-	dprintf("this_extent: lstart %u pstart %llu len %u\n",
-		inode->this_extent.lstart,
-		inode->this_extent.pstart,
-		inode->this_extent.len);
-
-	chunk = min(sectors, inode->this_extent.len);
+	chunk = min((uint32_t)sectors, ext->len - delta);
 	len = chunk << SECTOR_SHIFT(fs);
 
 	dprintf("   I/O: inode %p @ %u start %llu len %u\n",
-		inode, inode->this_extent.lstart,
-		inode->this_extent.pstart, chunk);
+		inode, lsector, ext->pstart + delta, chunk);
 
-	if (inode->this_extent.pstart == EXTENT_ZERO) {
+	if (ext->pstart == EXTENT_ZERO)
 	    memset(buf, 0, len);
-	} else {
-	    disk->rdwr_sectors(disk, buf, inode->this_extent.pstart, chunk, 0);
-	    inode->this_extent.pstart += chunk;
-	}
+	else
+	    disk->rdwr_sectors(disk, buf, ext->pstart + delta, chunk, 0);
 
 	buf += len;
 	sectors -= chunk;
 	bytes_read += len;
-	inode->this_extent.lstart += chunk;
-	inode->this_extent.len -= chunk;
+	lsector += chunk;
     }
 
     bytes_read = min(bytes_read, bytes_left);
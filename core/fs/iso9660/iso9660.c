@@ -91,6 +91,207 @@ static bool iso_compare_name(const char *de_name, size_t len,
     return true;
 }
 
+/*
+ * Per-directory name index.
+ *
+ * The first lookup in a directory decodes the name of every record once
+ * (the Rock Ridge NM name if there is one, otherwise the ISO 9660 name
+ * in the lowercase form iso_compare_name() uses) and hashes it, so later
+ * lookups in the same directory inode cost a hash probe instead of a
+ * scan with a SUSP walk per record.  Hashes are of the lowercased name,
+ * so that one probe serves both the case sensitive Rock Ridge names and
+ * the case insensitive ISO names.
+ */
+struct iso_dir_name {
+    uint32_t hash;
+    uint32_t pos;		/* Byte offset of the record in the directory */
+    uint32_t name;		/* Offset of the name in the string pool */
+    uint32_t next;		/* Next entry in the bucket, or ISO_DIR_NONE */
+    bool rr;			/* Rock Ridge name: compare case sensitively */
+};
+
+#define ISO_DIR_NONE	((uint32_t)-1)
+
+struct iso_dir_index {
+    struct iso_dir_name *names;
+    uint32_t count, size;
+    char *pool;
+    uint32_t pool_len, pool_size;
+    uint32_t mask;		/* Number of buckets - 1 */
+    uint32_t *buckets;
+};
+
+static uint32_t iso_name_hash(const char *name)
+{
+    uint32_t hash = 2166136261U;
+
+    while (*name)
+	hash = (hash ^ (uint8_t)iso_tolower(*name++)) * 16777619;
+
+    return hash;
+}
+
+static void iso_dir_index_free(struct iso_dir_index *idx)
+{
+    if (!idx)
+	return;
+
+    free(idx->names);
+    free(idx->pool);
+    free(idx->buckets);
+    free(idx);
+}
+
+static int iso_dir_index_add(struct iso_dir_index *idx, uint32_t pos,
+			     const char *name, int len, bool rr)
+{
+    struct iso_dir_name *dn;
+    void *p;
+
+    if (idx->count == idx->size) {
+	idx->size = idx->size ? idx->size << 1 : 64;
+	p = realloc(idx->names, idx->size * sizeof *idx->names);
+	if (!p)
+	    return -1;
+	idx->names = p;
+    }
+
+    while (idx->pool_len + len + 1 > idx->pool_size) {
+	idx->pool_size = idx->pool_size ? idx->pool_size << 1 : 1024;
+	p = realloc(idx->pool, idx->pool_size);
+	if (!p)
+	    return -1;
+	idx->pool = p;
+    }
+
+    dn = &idx->names[idx->count++];
+    dn->pos = pos;
+    dn->name = idx->pool_len;
+    dn->rr = rr;
+    memcpy(idx->pool + idx->pool_len, name, len);
+    idx->pool[idx->pool_len + len] = '\0';
+    idx->pool_len += len + 1;
+    dn->hash = iso_name_hash(idx->pool + dn->name);
+
+    return 0;
+}
+
+static struct iso_dir_index *iso_dir_index_build(struct inode *inode)
+{
+    struct fs_info *fs = inode->fs;
+    struct iso_dir_index *idx;
+    const struct iso_dir_entry *de;
+    const char *data;
+    char iso_name[256];
+    char *rr_name;
+    uint32_t blk, offset, nbuckets, i, *bucket;
+    int de_len, name_len, ret;
+
+    idx = zalloc(sizeof *idx);
+    if (!idx)
+	return NULL;
+
+    for (blk = 0; blk < inode->blocks; blk++) {
+	data = get_cache(fs->fs_dev, PVT(inode)->lba + blk);
+
+	for (offset = 0; ; offset += de_len) {
+	    de = (const struct iso_dir_entry *)(data + offset);
+	    de_len = offset + 33 <= BLOCK_SIZE(fs) ? de->length : 0;
+
+	    /* Zero = end of sector, or corrupt directory entry */
+	    if (de_len < 33 || offset + de_len > BLOCK_SIZE(fs))
+		break;
+
+	    rr_name = NULL;
+	    ret = susp_rr_get_nm(fs, (char *) de, &rr_name, &name_len);
+	    if (ret > 0) {
+		ret = iso_dir_index_add(idx, (blk << BLOCK_SHIFT(fs)) + offset,
+					rr_name, name_len, true);
+		free(rr_name);
+	    } else {
+		name_len = iso_convert_name(iso_name, de->name, de->name_len);
+		ret = iso_dir_index_add(idx, (blk << BLOCK_SHIFT(fs)) + offset,
+					iso_name, name_len, false);
+	    }
+	    if (ret)
+		goto err;
+	}
+    }
+
+    for (nbuckets = 16; nbuckets < idx->count; nbuckets <<= 1)
+	;
+    idx->mask = nbuckets - 1;
+    idx->buckets = malloc(nbuckets * sizeof *idx->buckets);
+    if (!idx->buckets)
+	goto err;
+    memset(idx->buckets, 0xff, nbuckets * sizeof *idx->buckets);
+
+    /* Insert backwards, so each chain is in directory order */
+    for (i = idx->count; i--; ) {
+	bucket = &idx->buckets[idx->names[i].hash & idx->mask];
+	idx->names[i].next = *bucket;
+	*bucket = i;
+    }
+
+    dprintf("iso: indexed %u names in directory at %u\n",
+	    idx->count, PVT(inode)->lba);
+    return idx;
+
+err:
+    iso_dir_index_free(idx);
+    return NULL;
+}
+
+/*
+ * Find a entry in the specified dir with name _dname_, through the
+ * directory's name index.  Returns false if there is no index.
+ */
+static bool iso_index_find_entry(const char *dname, struct inode *inode,
+				 const struct iso_dir_entry **dep)
+{
+    struct fs_info *fs = inode->fs;
+    struct iso_dir_index *idx = PVT(inode)->index;
+    const struct iso_dir_name *dn;
+    const char *name, *p;
+    const char *data;
+    uint32_t hash, i;
+
+    if (!idx) {
+	idx = PVT(inode)->index = iso_dir_index_build(inode);
+	if (!idx)
+	    return false;
+    }
+
+    *dep = NULL;
+    hash = iso_name_hash(dname);
+    for (i = idx->buckets[hash & idx->mask]; i != ISO_DIR_NONE; i = dn->next) {
+	dn = &idx->names[i];
+	if (dn->hash != hash)
+	    continue;
+
+	name = idx->pool + dn->name;
+	if (dn->rr) {
+	    if (strcmp(name, dname))
+		continue;
+	} else {
+	    for (p = dname; *name == iso_tolower(*p); name++, p++)
+		if (!*p)
+		    break;
+	    if (*name != iso_tolower(*p))
+		continue;
+	}
+
+	data = get_cache(fs->fs_dev, PVT(inode)->lba +
+			 (dn->pos >> BLOCK_SHIFT(fs)));
+	*dep = (const struct iso_dir_entry *)
+	    (data + (dn->pos & (BLOCK_SIZE(fs) - 1)));
+	dprintf("Found (by %s name, indexed).\n", dn->rr ? "RR" : "ISO");
+	break;
+    }
+
+    return true;
+}
+
 /*
  * Find a entry in the specified dir with name _dname_.
  */
@@ -107,7 +308,10 @@ iso_find_entry(const char *dname, struct inode *inode)
     char *rr_name = NULL;
 
     dprintf("iso_find_entry: \"%s\"\n", dname);
-    
+
+    if (iso_index_find_entry(dname, inode, &de))
+	return de;
+
     while (1) {
 	if (!data) {
 	    dprintf("Getting block %d from block %llu\n", i, dir_block);
@@ -184,6 +388,11 @@ static struct inode *iso_get_inode(struct fs_info *fs,
     return inode;
 }
 
+static void iso_free_inode(struct inode *inode)
+{
+    iso_dir_index_free(PVT(inode)->index);
+}
+
 static struct inode *iso_iget_root(struct fs_info *fs)
 {
     const struct iso_dir_entry *root = &ISO_SB(fs)->root;
@@ -321,7 +530,7 @@ static int iso_fs_init(struct fs_info *fs)
 
 const struct fs_ops iso_fs_ops = {
     .fs_name       = "iso",
-    .fs_flags      = FS_USEMEM | FS_THISIND,
+    .fs_flags      = FS_USEMEM | FS_THISIND | FS_SEEKABLE,
     .fs_init       = iso_fs_init,
     .searchdir     = NULL, 
     .getfssec      = generic_getfssec,
@@ -332,5 +541,6 @@ const struct fs_ops iso_fs_ops = {
     .iget          = iso_iget,
     .readdir       = iso_readdir,
     .next_extent   = no_next_extent,
+    .free_inode    = iso_free_inode,
     .fs_uuid       = NULL,
 };
@@ -47,8 +47,11 @@ struct iso_sb_info {
 /*
  * iso9660 private inode information
  */
+struct iso_dir_index;
+
 struct iso9660_pvt_inode {
     uint32_t lba;		/* Starting LBA of file data area*/
+    struct iso_dir_index *index; /* Directory name index, built on demand */
 };
 
 #define PVT(i) ((struct iso9660_pvt_inode *)((i)->pvt))
@@ -30,6 +30,7 @@
 #include <ilog2.h>
 #include <klibc/compiler.h>
 #include <ctype.h>
+#include <minmax.h>
 
 #include "codepage.h"
 #include "ntfs.h"
@@ -180,6 +181,157 @@ out:
     return -1;
 }
 
+/*
+ * Decode the mapping pairs of a non-resident attribute into rlist,
+ * holes included, so that any VCN can be mapped by a binary search
+ * instead of walking the byte stream from its start.
+ */
+static int ntfs_decode_runlist(struct ntfs_attr_record *attr,
+                               struct runlist *rlist)
+{
+    uint8_t *attr_len;
+    uint8_t *stream;
+    struct mapping_chunk chunk;
+    struct runlist_element run;
+    uint32_t offset;
+    int err;
+
+    attr_len = (uint8_t *)attr + attr->len;
+    stream = mapping_chunk_init(attr, &chunk, &offset);
+    chunk.vcn = attr->data.non_resident.lowest_vcn;
+    for (;;) {
+        err = parse_data_run(stream, &offset, attr_len, &chunk);
+        if (err) {
+            printf("parse_data_run()\n");
+            goto out;
+        }
+
+        if (chunk.flags & MAP_END)
+            break;
+
+        run.vcn = chunk.vcn;
+        run.lcn = chunk.flags & MAP_UNALLOCATED ? RUNLIST_SPARSE : chunk.lcn;
+        run.len = chunk.len;
+        if (run.len && runlist_append(rlist, &run)) {
+            malloc_error("runlist");
+            goto out;
+        }
+
+        /* update for next VCN */
+        chunk.vcn += chunk.len;
+    }
+
+    return 0;
+
+out:
+    runlist_free(rlist);
+
+    return -1;
+}
+
+/*
+ * Map a VCN of $MFT to its LCN, decoding the $MFT runlist the first time
+ * a record beyond the first cluster is wanted.  The records describing
+ * $MFT itself are always within its first extent, so while the runlist
+ * is being read the first extent is assumed to be contiguous.
+ */
+static struct runlist mft_rlist;
+
+static int64_t ntfs_mft_vcn_to_lcn(struct fs_info *fs, uint64_t vcn)
+{
+    struct ntfs_sb_info *sbi = NTFS_SB(fs);
+    static bool loading;
+    struct ntfs_mft_record *mrec, *lmrec;
+    struct ntfs_attr_record *attr;
+    const struct runlist_element *run;
+    uint64_t start_blk = 0;
+
+    if (!vcn || loading)
+        return sbi->mft_lcn + vcn;
+
+    if (runlist_is_empty(&mft_rlist)) {
+        loading = true;
+        mrec = sbi->mft_record_lookup(fs, 0, &start_blk);
+        loading = false;
+        if (!mrec) {
+            dprintf("%s: read MFT(0) failed\n", __func__);
+            return 0;
+        }
+
+        lmrec = mrec;
+        attr = ntfs_attr_lookup(fs, NTFS_AT_DATA, &mrec, lmrec);
+        if (!attr || !attr->non_resident ||
+            ntfs_decode_runlist(attr, &mft_rlist)) {
+            dprintf("%s: no $MFT data runs\n", __func__);
+            runlist_free(&mft_rlist);
+            free(mrec);
+            return 0;
+        }
+
+        free(mrec);
+    }
+
+    run = runlist_find(&mft_rlist, vcn);
+    if (!run || run->lcn < 0)
+        return 0;
+
+    return run->lcn + (vcn - run->vcn);
+}
+
+/*
+ * A small cache of MFT records, already fixed up and validated, keyed
+ * by record number.  Path lookups keep coming back to the same few
+ * directories; callers get (and free) a private copy as before.
+ */
+#define NTFS_MFT_CACHE_ENTRIES  16
+
+static struct ntfs_mft_cache {
+    uint32_t file;
+    uint32_t stamp;             /* Last use, for LRU replacement */
+    uint8_t *rec;               /* NULL if unused */
+} mft_cache[NTFS_MFT_CACHE_ENTRIES];
+static uint32_t mft_cache_clock;
+
+static struct ntfs_mft_cache *ntfs_mft_cache_find(uint32_t file)
+{
+    struct ntfs_mft_cache *c;
+
+    for (c = mft_cache; c < &mft_cache[NTFS_MFT_CACHE_ENTRIES]; c++) {
+        if (c->rec && c->file == file) {
+            c->stamp = ++mft_cache_clock;
+            return c;
+        }
+    }
+
+    return NULL;
+}
+
+static void ntfs_mft_cache_insert(struct fs_info *fs, uint32_t file,
+                                  const uint8_t *rec)
+{
+    const uint64_t mft_record_size = NTFS_SB(fs)->mft_record_size;
+    struct ntfs_mft_cache *c, *victim = mft_cache;
+
+    for (c = mft_cache; c < &mft_cache[NTFS_MFT_CACHE_ENTRIES]; c++) {
+        if (!c->rec) {
+            victim = c;
+            break;
+        }
+        if (c->stamp < victim->stamp)
+            victim = c;
+    }
+
+    if (!victim->rec) {
+        victim->rec = malloc(mft_record_size);
+        if (!victim->rec)
+            return;
+    }
+
+    memcpy(victim->rec, rec, mft_record_size);
+    victim->file = file;
+    victim->stamp = ++mft_cache_clock;
+}
+
 /* AndyAlex: read and validate single MFT record. Keep in mind that MFT itself can be fragmented */
 static struct ntfs_mft_record *ntfs_mft_record_lookup_any(struct fs_info *fs,
                                                 uint32_t file, block_t *out_blk, bool is_v31)
@@ -188,71 +340,50 @@ static struct ntfs_mft_record *ntfs_mft_record_lookup_any(struct fs_info *fs,
     uint8_t *buf = NULL;
     const uint32_t mft_record_shift = ilog2(mft_record_size);
     const uint32_t clust_byte_shift = NTFS_SB(fs)->clust_byte_shift;
+    const uint64_t mft_offset = (uint64_t)file << mft_record_shift;
     uint64_t next_offset = 0;
-    uint64_t lcn = 0;
+    int64_t lcn;
+    uint64_t lcn_cursor;
+    uint64_t byte;
     block_t blk = 0;
     uint64_t offset = 0;
+    struct ntfs_mft_cache *c;
+    struct ntfs_mft_record *mrec;
+    int err = 0;
 
-    struct ntfs_mft_record *mrec = NULL, *lmrec = NULL;
-    uint64_t start_blk = 0;
-    struct ntfs_attr_record *attr = NULL;
-    uint8_t *stream = NULL;
-    uint32_t attr_offset = 0;
-    uint8_t *attr_len = NULL;
-    struct mapping_chunk chunk;
+    dprintf("in %s(%s)\n", __func__,(is_v31?"v3.1":"v3.0"));
 
-    int err = 0;
+    /* Allocate buffer */
+    buf = (uint8_t *)malloc(mft_record_size);
+    if (!buf) {malloc_error("uint8_t *");return 0;}
+
+    c = ntfs_mft_cache_find(file);
+    if (c && (!is_v31 ||
+              ((struct ntfs_mft_record *)c->rec)->mft_record_no == file)) {
+      memcpy(buf, c->rec, mft_record_size);
+      if (out_blk)
+        *out_blk = mft_offset >> BLOCK_SHIFT(fs);
+      return (struct ntfs_mft_record *)buf;
+    }
 
     /* determine MFT record's LCN */
-    uint64_t vcn = (file << mft_record_shift >> clust_byte_shift);
-    dprintf("in %s(%s)\n", __func__,(is_v31?"v3.1":"v3.0"));
-    if (0==vcn) {
-      lcn = NTFS_SB(fs)->mft_lcn;
-    } else do {
-      dprintf("%s: looking for VCN %u for MFT record %u\n", __func__,(unsigned)vcn,(unsigned)file);
-      mrec = NTFS_SB(fs)->mft_record_lookup(fs, 0, &start_blk);
-      if (!mrec) {dprintf("%s: read MFT(0) failed\n", __func__); break;}
-      lmrec = mrec;
-      if (get_inode_mode(mrec) != DT_REG) {dprintf("%s: $MFT is not a file\n", __func__); break;}
-      attr = ntfs_attr_lookup(fs, NTFS_AT_DATA, &mrec, lmrec);
-      if (!attr) {dprintf("%s: $MFT have no data attr\n", __func__); break;}
-      if (!attr->non_resident) {dprintf("%s: $MFT data attr is resident\n", __func__); break;}
-      attr_len = (uint8_t *)attr + attr->len;
-      stream = mapping_chunk_init(attr, &chunk, &attr_offset);
-      while (true) {
-        err = parse_data_run(stream, &attr_offset, attr_len, &chunk);
-        if (err) {dprintf("%s: $MFT data run parse failed with error %d\n", __func__,err); break;}
-        if (chunk.flags & MAP_UNALLOCATED) continue;
-        if (chunk.flags & MAP_END) break;
-        if (chunk.flags & MAP_ALLOCATED) {
-          dprintf("%s: Chunk: VCN=%u, LCN=%u, len=%u\n", __func__,(unsigned)chunk.vcn,(unsigned)chunk.lcn,(unsigned)chunk.len);
-          if ((vcn>=chunk.vcn)&&(vcn<chunk.vcn+chunk.len)) {
-            lcn=vcn-chunk.vcn+chunk.lcn;
-            dprintf("%s: VCN %u for MFT record %u maps to lcn %u\n", __func__,(unsigned)vcn,(unsigned)file,(unsigned)lcn);
-            break;
-          }
-          chunk.vcn += chunk.len;
-        }
-      }
-    } while(false);
-    if (mrec!=NULL) free(mrec);
-    mrec = NULL;
-    if (0==lcn) {
-      dprintf("%s: unable to map VCN %u for MFT record %u\n", __func__,(unsigned)vcn,(unsigned)file);
+    lcn = ntfs_mft_vcn_to_lcn(fs, mft_offset >> clust_byte_shift);
+    if (lcn <= 0) {
+      dprintf("%s: unable to map MFT record %u\n", __func__,(unsigned)file);
+      free(buf);
       return NULL;
     }
 
     /* determine MFT record's block number */
-    blk = (lcn << clust_byte_shift >> BLOCK_SHIFT(fs));
-    offset = (file << mft_record_shift) % BLOCK_SIZE(fs);
-
-    /* Allocate buffer */
-    buf = (uint8_t *)malloc(mft_record_size);
-    if (!buf) {malloc_error("uint8_t *");return 0;}
+    byte = ((uint64_t)lcn << clust_byte_shift) +
+        (mft_offset & ((UINT64_C(1) << clust_byte_shift) - 1));
+    blk = byte >> BLOCK_SHIFT(fs);
+    offset = byte & (BLOCK_SIZE(fs) - 1);
+    lcn_cursor = lcn;
 
     /* Read block */
     err = ntfs_read(fs, buf, mft_record_size, mft_record_size, &blk,
-                    &offset, &next_offset, &lcn);
+                    &offset, &next_offset, &lcn_cursor);
     if (err) {
       dprintf("%s: error read block %u from cache\n", __func__, blk);
       printf("Error while reading from cache.\n");
@@ -268,8 +399,9 @@ static struct ntfs_mft_record *ntfs_mft_record_lookup_any(struct fs_info *fs,
     if (mrec->magic != NTFS_MAGIC_FILE) mrec = NULL;
     if (mrec && is_v31) if (mrec->mft_record_no != file) mrec = NULL;
     if (mrec!=NULL) {
+      ntfs_mft_cache_insert(fs, file, buf);
       if (out_blk) {
-        *out_blk = (file << mft_record_shift >> BLOCK_SHIFT(fs));   /* update record starting block */
+        *out_blk = mft_offset >> BLOCK_SHIFT(fs);   /* update record starting block */
       }
       return mrec;          /* found MFT record */
     }
@@ -378,6 +510,15 @@ static int parse_data_run(const void *stream, uint32_t *offset,
 
     chunk->len = res;   /* get length data */
 
+    /* no LCN bytes at all: VCNs from cur_vcn to next_vcn - 1 are
+     * unallocated, and the next run is still relative to this LCN
+     */
+    if (!l) {
+        chunk->flags |= MAP_UNALLOCATED;
+        *offset += v + 1;
+        return 0;
+    }
+
     byte = (uint8_t *)buf + v + l;
     count = l;
 
@@ -390,11 +531,7 @@ static int parse_data_run(const void *stream, uint32_t *offset,
         res = (res << byte_shift) | *byte--;
 
     chunk->lcn += res;
-    /* are VCNS from cur_vcn to next_vcn - 1 unallocated ? */
-    if (!chunk->lcn)
-        chunk->flags |= MAP_UNALLOCATED;
-    else
-        chunk->flags |= MAP_ALLOCATED;
+    chunk->flags |= MAP_ALLOCATED;
 
     *offset += v + l + 1;
 
@@ -614,11 +751,6 @@ static int index_inode_setup(struct fs_info *fs, unsigned long mft_no,
     struct ntfs_mft_record *mrec, *lmrec;
     struct ntfs_attr_record *attr;
     enum dirent_type d_type;
-    uint8_t *attr_len;
-    struct mapping_chunk chunk;
-    int err;
-    uint8_t *stream;
-    uint32_t offset;
 
     dprintf("in %s()\n", __func__);
 
@@ -675,31 +807,11 @@ static int index_inode_setup(struct fs_info *fs, unsigned long mft_no,
                 (uint32_t)((uint8_t *)attr + attr->data.resident.value_offset);
             inode->size = attr->data.resident.value_len;
         } else {
-            attr_len = (uint8_t *)attr + attr->len;
-
-            stream = mapping_chunk_init(attr, &chunk, &offset);
-            NTFS_PVT(inode)->data.non_resident.rlist = NULL;
-            for (;;) {
-                err = parse_data_run(stream, &offset, attr_len, &chunk);
-                if (err) {
-                    printf("parse_data_run()\n");
-                    goto out;
-                }
-
-                if (chunk.flags & MAP_UNALLOCATED)
-                    continue;
-                if (chunk.flags & MAP_END)
-                    break;
-                if (chunk.flags &  MAP_ALLOCATED) {
-                    /* append new run to the runlist */
-                    runlist_append(&NTFS_PVT(inode)->data.non_resident.rlist,
-                                    (struct runlist_element *)&chunk);
-                    /* update for next VCN */
-                    chunk.vcn += chunk.len;
-                }
-            }
+            if (ntfs_decode_runlist(attr,
+                                    &NTFS_PVT(inode)->data.non_resident.rlist))
+                goto out;
 
-            if (runlist_is_empty(NTFS_PVT(inode)->data.non_resident.rlist)) {
+            if (runlist_is_empty(&NTFS_PVT(inode)->data.non_resident.rlist)) {
                 printf("No mapping found\n");
                 goto out;
             }
@@ -720,30 +832,203 @@ out:
     return -1;
 }
 
+/* Read len bytes at byte offset pos of a non-resident attribute */
+static int ntfs_read_runs(struct fs_info *fs, const struct runlist *rlist,
+                          uint64_t pos, void *buf, uint32_t len)
+{
+    const uint32_t clust_byte_shift = NTFS_SB(fs)->clust_byte_shift;
+    const uint64_t clust_mask = (UINT64_C(1) << clust_byte_shift) - 1;
+    const struct runlist_element *run;
+    const uint8_t *data;
+    uint8_t *p = buf;
+    uint64_t vcn, byte;
+    uint32_t n;
+
+    while (len) {
+        vcn = pos >> clust_byte_shift;
+        run = runlist_find(rlist, vcn);
+        if (!run)
+            return -1;
+
+        n = min(len, (uint32_t)(clust_mask + 1 - (pos & clust_mask)));
+        if (run->lcn == RUNLIST_SPARSE) {
+            memset(p, 0, n);
+        } else {
+            byte = ((run->lcn + (vcn - run->vcn)) << clust_byte_shift) +
+                (pos & clust_mask);
+            n = min(n, (uint32_t)(BLOCK_SIZE(fs) -
+                                  (byte & (BLOCK_SIZE(fs) - 1))));
+            data = get_cache(fs->fs_dev, byte >> BLOCK_SHIFT(fs));
+            if (!data)
+                return -1;
+            memcpy(p, data + (byte & (BLOCK_SIZE(fs) - 1)), n);
+        }
+
+        p += n;
+        pos += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * The volume's $UpCase table, which defines the order of file names in
+ * directory indexes.  Read once; if that fails, names are compared with
+ * only ASCII letters folded.
+ */
+static uint16_t *ntfs_upcase;
+
+static void ntfs_load_upcase(struct fs_info *fs)
+{
+    static bool tried;
+    struct ntfs_mft_record *mrec, *lmrec;
+    struct ntfs_attr_record *attr;
+    struct runlist rlist = { NULL, 0, 0 };
+    uint16_t *upcase = NULL;
+    uint32_t len;
+    unsigned i;
+
+    if (tried)
+        return;
+    tried = true;
+
+    mrec = NTFS_SB(fs)->mft_record_lookup(fs, FILE_UpCase, NULL);
+    if (!mrec)
+        goto out;
+
+    lmrec = mrec;
+    attr = ntfs_attr_lookup(fs, NTFS_AT_DATA, &mrec, lmrec);
+    if (!attr || !attr->non_resident || ntfs_decode_runlist(attr, &rlist))
+        goto out;
+
+    upcase = malloc(NTFS_UPCASE_LEN * sizeof *upcase);
+    if (!upcase)
+        goto out;
+
+    for (i = 0; i < NTFS_UPCASE_LEN; i++)
+        upcase[i] = i;
+
+    len = min(attr->data.non_resident.data_size,
+              (int64_t)(NTFS_UPCASE_LEN * sizeof *upcase));
+    if (ntfs_read_runs(fs, &rlist, 0, upcase, len)) {
+        free(upcase);
+        goto out;
+    }
+
+    ntfs_upcase = upcase;
+
+out:
+    if (!ntfs_upcase)
+        dprintf("%s: no $UpCase table, folding ASCII only\n", __func__);
+    runlist_free(&rlist);
+    free(mrec);
+}
+
+static inline uint16_t ntfs_toupper(uint16_t c)
+{
+    if (ntfs_upcase)
+        return ntfs_upcase[c];
+
+    return c < 0x80 ? toupper(c) : c;
+}
+
+/*
+ * COLLATION_FILE_NAME: compare upcased, then the shorter name first.
+ * name2 is the little-endian key of an index entry, which need not be
+ * aligned.
+ */
+static int ntfs_collate_names(const uint16_t *name1, unsigned len1,
+                              const uint8_t *name2, unsigned len2)
+{
+    unsigned i;
+    uint16_t c1, c2;
+
+    for (i = 0; i < len1 && i < len2; i++) {
+        c1 = ntfs_toupper(name1[i]);
+        c2 = ntfs_toupper(name2[2 * i] | (name2[2 * i + 1] << 8));
+        if (c1 != c2)
+            return c1 < c2 ? -1 : 1;
+    }
+
+    return len1 < len2 ? -1 : len1 > len2;
+}
+
+/*
+ * Search one node of a directory index.  Entries are in collation
+ * order, so the scan stops at the first entry not less than the name.
+ * Returns 1 with *iep set to the matching entry, 0 with *iep set to the
+ * entry whose subnode would hold the name, or -1 if the node is corrupt.
+ */
+static int ntfs_idx_node_lookup(struct ntfs_idx_header *ih, const char *dname,
+                                const uint16_t *uname, unsigned len,
+                                struct ntfs_idx_entry **iep)
+{
+    struct ntfs_idx_entry *ie;
+    uint8_t *end = (uint8_t *)ih + ih->index_len;
+    int cmp;
+
+    ie = (struct ntfs_idx_entry *)((uint8_t *)ih + ih->entries_offset);
+    for (;; ie = (struct ntfs_idx_entry *)((uint8_t *)ie + ie->len)) {
+        /* bounds checks */
+        if ((uint8_t *)ie + sizeof(struct ntfs_idx_entry_header) > end ||
+            ie->len < sizeof(struct ntfs_idx_entry_header) ||
+            (uint8_t *)ie + ie->len > end)
+            return -1;
+
+        /* last entry cannot contain a key. it can however contain
+         * a pointer to a child node in the B+ tree
+         */
+        if (ie->flags & INDEX_ENTRY_END)
+            break;
+
+        cmp = ntfs_collate_names(uname, len, (const uint8_t *)ie +
+                                 offsetof(struct ntfs_idx_entry,
+                                          key.file_name.file_name),
+                                 ie->key.file_name.file_name_len);
+        if (cmp < 0)
+            break;
+
+        /* POSIX names that differ only in case collate equal */
+        if (!cmp && ntfs_filename_cmp(dname, ie)) {
+            *iep = ie;
+            return 1;
+        }
+    }
+
+    *iep = ie;
+    return 0;
+}
+
 static struct inode *ntfs_index_lookup(const char *dname, struct inode *dir)
 {
     struct fs_info *fs = dir->fs;
     struct ntfs_mft_record *mrec, *lmrec;
-    block_t blk;
-    uint64_t blk_offset;
     struct ntfs_attr_record *attr;
     struct ntfs_idx_root *ir;
+    struct ntfs_idx_header *ih;
     struct ntfs_idx_entry *ie;
-    const uint64_t blk_size = UINT64_C(1) << BLOCK_SHIFT(fs);
-    uint8_t buf[blk_size];
-    struct ntfs_idx_allocation *iblk;
-    int err;
-    uint8_t *stream;
-    uint8_t *attr_len;
-    struct mapping_chunk chunk;
-    uint32_t offset;
+    struct ntfs_idx_allocation *iblk = NULL;
+    struct runlist rlist = { NULL, 0, 0 };
+    uint16_t uname[NTFS_MAX_FILE_NAME_LEN];
+    unsigned len, i;
+    uint32_t block_size;
+    unsigned vcn_shift;
     int64_t vcn;
-    int64_t lcn;
-    int64_t last_lcn;
+    int depth;
+    int err;
+    unsigned long mft_no;
     struct inode *inode;
 
     dprintf("in %s()\n", __func__);
 
+    len = strlen(dname);
+    if (len > NTFS_MAX_FILE_NAME_LEN)
+        return NULL;
+
+    for (i = 0; i < len; i++)
+        uname[i] = (uint8_t)dname[i];
+
     mrec = NTFS_SB(fs)->mft_record_lookup(fs, NTFS_PVT(dir)->mft_no, NULL);
     if (!mrec) {
         printf("No MFT record found.\n");
@@ -757,133 +1042,107 @@ static struct inode *ntfs_index_lookup(const char *dname, struct inode *dir)
         goto out;
     }
 
+    ntfs_load_upcase(fs);
+
     ir = (struct ntfs_idx_root *)((uint8_t *)attr +
                             attr->data.resident.value_offset);
-    ie = (struct ntfs_idx_entry *)((uint8_t *)&ir->index +
-                                ir->index.entries_offset);
-    for (;; ie = (struct ntfs_idx_entry *)((uint8_t *)ie + ie->len)) {
-        /* bounds checks */
-        if ((uint8_t *)ie < (uint8_t *)mrec ||
-            (uint8_t *)ie + sizeof(struct ntfs_idx_entry_header) >
-            (uint8_t *)&ir->index + ir->index.index_len ||
-            (uint8_t *)ie + ie->len >
-            (uint8_t *)&ir->index + ir->index.index_len)
-            goto index_err;
+    ih = &ir->index;
 
-        /* last entry cannot contain a key. it can however contain
-         * a pointer to a child node in the B+ tree so we just break out
-         */
-        if (ie->flags & INDEX_ENTRY_END)
-            break;
+    /* Index blocks are addressed in clusters, or in 512-byte units if
+     * they are smaller than a cluster
+     */
+    block_size = ir->index_block_size;
+    vcn_shift = block_size < NTFS_SB(fs)->clust_size ?
+        NTFS_BLOCK_SHIFT : NTFS_SB(fs)->clust_byte_shift;
 
-        if (ntfs_filename_cmp(dname, ie))
+    for (depth = 0; ; depth++) {
+        err = ntfs_idx_node_lookup(ih, dname, uname, len, &ie);
+        if (err < 0)
+            goto index_err;
+        if (err > 0)
             goto found;
-    }
-
-    /* check for the presence of a child node */
-    if (!(ie->flags & INDEX_ENTRY_NODE)) {
-        printf("No child node, aborting...\n");
-        goto out;
-    }
 
-    /* then descend into child node */
+        /* check for the presence of a child node */
+        if (!(ie->flags & INDEX_ENTRY_NODE))
+            goto not_found;
 
-    attr = ntfs_attr_lookup(fs, NTFS_AT_INDEX_ALLOCATION, &mrec, lmrec);
-    if (!attr) {
-        printf("No attribute found.\n");
-        goto out;
-    }
-
-    if (!attr->non_resident) {
-        printf("WTF ?! $INDEX_ALLOCATION isn't really resident.\n");
-        goto out;
-    }
+        if (depth >= NTFS_MAX_INDEX_DEPTH)
+            goto index_err;
 
-    attr_len = (uint8_t *)attr + attr->len;
-    stream = mapping_chunk_init(attr, &chunk, &offset);
-    do {
-        err = parse_data_run(stream, &offset, attr_len, &chunk);
-        if (err)
-            break;
+        /* the VCN of the child node ends the entry */
+        vcn = *(int64_t *)((uint8_t *)ie + ie->len - sizeof(int64_t));
 
-        if (chunk.flags & MAP_UNALLOCATED)
-            continue;
+        /* then descend into child node */
+        if (!iblk) {
+            attr = ntfs_attr_lookup(fs, NTFS_AT_INDEX_ALLOCATION, &mrec,
+                                    lmrec);
+            if (!attr) {
+                printf("No attribute found.\n");
+                goto out;
+            }
 
-        if (chunk.flags & MAP_ALLOCATED) {
-            dprintf("%d cluster(s) starting at 0x%08llX\n", chunk.len,
-                    chunk.lcn);
+            if (!attr->non_resident) {
+                printf("WTF ?! $INDEX_ALLOCATION isn't really resident.\n");
+                goto out;
+            }
 
-            vcn = 0;
-            lcn = chunk.lcn;
-            while (vcn < chunk.len) {
-                blk = (lcn + vcn) << NTFS_SB(fs)->clust_shift <<
-                    SECTOR_SHIFT(fs) >> BLOCK_SHIFT(fs);
+            if (block_size < sizeof *iblk)
+                goto index_err;
 
-                blk_offset = 0;
-                last_lcn = lcn;
-                lcn += vcn;
-                err = ntfs_read(fs, &buf, blk_size, blk_size, &blk,
-                                &blk_offset, NULL, (uint64_t *)&lcn);
-                if (err) {
-                    printf("Error while reading from cache.\n");
-                    goto not_found;
-                }
+            if (ntfs_decode_runlist(attr, &rlist))
+                goto out;
 
-                ntfs_fixups_writeback(fs, (struct ntfs_record *)&buf);
+            iblk = malloc(block_size);
+            if (!iblk) {
+                malloc_error("INDX record");
+                goto out;
+            }
+        }
 
-                iblk = (struct ntfs_idx_allocation *)&buf;
-                if (iblk->magic != NTFS_MAGIC_INDX) {
-                    printf("Not a valid INDX record.\n");
-                    goto not_found;
-                }
+        if (ntfs_read_runs(fs, &rlist, (uint64_t)vcn << vcn_shift, iblk,
+                           block_size)) {
+            printf("Error while reading from cache.\n");
+            goto not_found;
+        }
 
-                ie = (struct ntfs_idx_entry *)((uint8_t *)&iblk->index +
-                                            iblk->index.entries_offset);
-                for (;; ie = (struct ntfs_idx_entry *)((uint8_t *)ie +
-                        ie->len)) {
-                    /* bounds checks */
-                    if ((uint8_t *)ie < (uint8_t *)iblk || (uint8_t *)ie +
-                        sizeof(struct ntfs_idx_entry_header) >
-                        (uint8_t *)&iblk->index + iblk->index.index_len ||
-                        (uint8_t *)ie + ie->len >
-                        (uint8_t *)&iblk->index + iblk->index.index_len)
-                        goto index_err;
-
-                    /* last entry cannot contain a key */
-                    if (ie->flags & INDEX_ENTRY_END)
-                        break;
-
-                    if (ntfs_filename_cmp(dname, ie))
-                        goto found;
-                }
+        ntfs_fixups_writeback(fs, (struct ntfs_record *)iblk);
 
-                lcn = last_lcn; /* restore the original LCN */
-                /* go to the next VCN */
-                vcn += (blk_size / (1 << NTFS_SB(fs)->clust_byte_shift));
-            }
+        if (iblk->magic != NTFS_MAGIC_INDX) {
+            printf("Not a valid INDX record.\n");
+            goto not_found;
         }
-    } while (!(chunk.flags & MAP_END));
+
+        ih = &iblk->index;
+        if (offsetof(struct ntfs_idx_allocation, index) + ih->index_len >
+            block_size)
+            goto index_err;
+    }
 
 not_found:
     dprintf("Index not found\n");
 
 out:
+    runlist_free(&rlist);
+    free(iblk);
     free(mrec);
 
     return NULL;
 
 found:
     dprintf("Index found\n");
+    mft_no = ie->data.dir.indexed_file;
+    runlist_free(&rlist);
+    free(iblk);
+    free(mrec);
+
     inode = new_ntfs_inode(fs);
-    err = index_inode_setup(fs, ie->data.dir.indexed_file, inode);
+    err = index_inode_setup(fs, mft_no, inode);
     if (err) {
         printf("Error in index_inode_setup()\n");
         free(inode);
-        goto out;
+        return NULL;
     }
 
-    free(mrec);
-
     return inode;
 
 index_err:
@@ -915,8 +1174,9 @@ static int ntfs_next_extent(struct inode *inode, uint32_t lstart)
     struct fs_info *fs = inode->fs;
     struct ntfs_sb_info *sbi = NTFS_SB(fs);
     sector_t pstart = 0;
-    struct runlist *rlist;
-    struct runlist *ret;
+    const struct runlist_element *run;
+    uint64_t vcn;
+    uint32_t sec;
     const uint32_t sec_size = SECTOR_SIZE(fs);
     const uint32_t sec_shift = SECTOR_SHIFT(fs);
 
@@ -927,27 +1187,20 @@ static int ntfs_next_extent(struct inode *inode, uint32_t lstart)
                 sec_shift;
         inode->next_extent.len = (inode->size + sec_size - 1) >> sec_shift;
     } else {
-        rlist = NTFS_PVT(inode)->data.non_resident.rlist;
-
-        if (!lstart || lstart >= NTFS_PVT(inode)->here) {
-            if (runlist_is_empty(rlist))
-                goto out;   /* nothing to do ;-) */
+        vcn = lstart >> sbi->clust_shift;
+        sec = lstart & sbi->clust_mask;
 
-            ret = runlist_remove(&rlist);
-
-            NTFS_PVT(inode)->here =
-                ((ret->run.len << sbi->clust_byte_shift) >> sec_shift);
-
-            pstart = ret->run.lcn << sbi->clust_shift;
-            inode->next_extent.len =
-                ((ret->run.len << sbi->clust_byte_shift) + sec_size - 1) >>
-                sec_shift;
+        run = runlist_find(&NTFS_PVT(inode)->data.non_resident.rlist, vcn);
+        if (!run)
+            goto out;
 
-            NTFS_PVT(inode)->data.non_resident.rlist = rlist;
+        if (run->lcn == RUNLIST_SPARSE)
+            pstart = EXTENT_ZERO;
+        else
+            pstart = ((run->lcn + (vcn - run->vcn)) << sbi->clust_shift) + sec;
 
-            free(ret);
-            ret = NULL;
-        }
+        inode->next_extent.len =
+            ((run->vcn + run->len - vcn) << sbi->clust_shift) - sec;
     }
 
     inode->next_extent.pstart = pstart;
@@ -1010,6 +1263,12 @@ out:
     return 0;
 }
 
+static void ntfs_free_inode(struct inode *inode)
+{
+    if (NTFS_PVT(inode)->non_resident)
+        runlist_free(&NTFS_PVT(inode)->data.non_resident.rlist);
+}
+
 static inline bool is_filename_printable(const char *s)
 {
     return s && (*s != '.' && *s != '$');
@@ -1372,5 +1631,6 @@ const struct fs_ops ntfs_fs_ops = {
     .iget_root      = ntfs_iget_root,
     .iget           = ntfs_iget,
     .next_extent    = ntfs_next_extent,
+    .free_inode     = ntfs_free_inode,
     .fs_uuid        = NULL,
 };
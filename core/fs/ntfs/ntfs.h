@@ -90,7 +90,7 @@ struct ntfs_inode {
             uint32_t offset;    /* Data offset */
         } resident;
         struct {            /* Used only if non_resident is set */
-            struct runlist *rlist;
+            struct runlist rlist;
         } non_resident;
     } data;
     uint32_t start_cluster; /* Starting cluster address */
@@ -319,6 +319,15 @@ struct ntfs_attr_list_entry {
 
 #define NTFS_MAX_FILE_NAME_LEN 255
 
+/* Entries in the $UpCase table, one per UTF-16 code unit */
+#define NTFS_UPCASE_LEN     0x10000
+
+/* Index blocks smaller than a cluster are addressed in these units */
+#define NTFS_BLOCK_SHIFT    9
+
+/* Directory index B+ trees deeper than this are taken as corrupt */
+#define NTFS_MAX_INDEX_DEPTH    32
+
 /* Possible namespaces for filenames in ntfs (8-bit) */
 enum {
     FILE_NAME_POSIX             = 0x00,
@@ -20,64 +20,78 @@
 #ifndef _RUNLIST_H_
 #define _RUNLIST_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* A run of clusters, or of unallocated (sparse) clusters if lcn < 0 */
 struct runlist_element {
     uint64_t vcn;
     int64_t lcn;
     uint64_t len;
 };
 
+#define RUNLIST_SPARSE  (-1LL)
+
+/* A decoded mapping pairs array, in ascending VCN order */
 struct runlist {
-    struct runlist_element run;
-    struct runlist *next;
+    struct runlist_element *runs;
+    unsigned int count;
+    unsigned int size;
 };
 
-static struct runlist *tail;
-
-static inline bool runlist_is_empty(struct runlist *rlist)
+static inline bool runlist_is_empty(const struct runlist *rlist)
 {
-    return !rlist;
+    return !rlist->count;
 }
 
-static inline struct runlist *runlist_alloc(void)
+static inline int runlist_append(struct runlist *rlist,
+                                 const struct runlist_element *elem)
 {
-    struct runlist *rlist;
+    struct runlist_element *runs;
+    unsigned int size;
 
-    rlist = malloc(sizeof *rlist);
-    if (!rlist)
-        malloc_error("runlist structure");
+    if (rlist->count == rlist->size) {
+        size = rlist->size ? rlist->size << 1 : 8;
+        runs = realloc(rlist->runs, size * sizeof *runs);
+        if (!runs)
+            return -1;
 
-    rlist->next = NULL;
+        rlist->runs = runs;
+        rlist->size = size;
+    }
+
+    rlist->runs[rlist->count++] = *elem;
 
-    return rlist;
+    return 0;
 }
 
-static inline void runlist_append(struct runlist **rlist,
-                                struct runlist_element *elem)
+/* Find the run mapping vcn, or NULL if it is past the end */
+static inline const struct runlist_element *
+runlist_find(const struct runlist *rlist, uint64_t vcn)
 {
-    struct runlist *n = runlist_alloc();
-
-    n->run = *elem;
-
-    if (runlist_is_empty(*rlist)) {
-        *rlist = n;
-        tail = n;
-    } else {
-        tail->next = n;
-        tail = n;
+    unsigned int lo = 0, hi = rlist->count, mid;
+    const struct runlist_element *run;
+
+    while (lo < hi) {
+        mid = (lo + hi) >> 1;
+        run = &rlist->runs[mid];
+        if (vcn < run->vcn)
+            hi = mid;
+        else if (vcn >= run->vcn + run->len)
+            lo = mid + 1;
+        else
+            return run;
     }
+
+    return NULL;
 }
 
-static inline struct runlist *runlist_remove(struct runlist **rlist)
+static inline void runlist_free(struct runlist *rlist)
 {
-    struct runlist *ret;
-
-    if (runlist_is_empty(*rlist))
-        return NULL;
-
-    ret = *rlist;
-    *rlist = ret->next;
-
-    return ret;
+    free(rlist->runs);
+    rlist->runs = NULL;
+    rlist->count = rlist->size = 0;
 }
 
 #endif /* _RUNLIST_H_ */
@@ -10,6 +10,7 @@
 
 const struct url_scheme url_schemes[] = {
     { "tftp", tftp_open, 0 },
+    { "mtftp", mtftp_open, 0 },
     { "http", http_open, O_DIRECTORY },
     { "ftp",  ftp_open,  O_DIRECTORY },
     { NULL, NULL, 0 },
@@ -234,6 +235,53 @@ void net_core_init(void)
     }
 }
 
+/**
+ * Receive the datagrams sent to a multicast group
+ *
+ * @param:socket, the open socket
+ * @param:group, the multicast group address
+ * @param:port, the port number the group is sent to, host-byte order
+ *
+ * @out: error code, 0 on success, -1 on failure
+ */
+int core_udp_join(struct pxe_pvt_inode *socket, uint32_t group, uint16_t port)
+{
+    struct net_private_lwip *priv = &socket->net.lwip;
+    struct ip_addr addr;
+    err_t err;
+
+    err = netconn_bind(priv->conn, NULL, port);
+    if (err) {
+	ddprintf("netconn_bind error %d\n", err);
+	return -1;
+    }
+
+    addr.addr = group;
+    err = netconn_join_leave_group(priv->conn, &addr, IP_ADDR_ANY,
+				   NETCONN_JOIN);
+    if (err) {
+	ddprintf("netconn_join_leave_group error %d\n", err);
+	return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Stop receiving a multicast group
+ *
+ * @param:socket, the open socket
+ * @param:group, the multicast group address
+ */
+void core_udp_leave(struct pxe_pvt_inode *socket, uint32_t group)
+{
+    struct net_private_lwip *priv = &socket->net.lwip;
+    struct ip_addr addr;
+
+    addr.addr = group;
+    netconn_join_leave_group(priv->conn, &addr, IP_ADDR_ANY, NETCONN_LEAVE);
+}
+
 void probe_undi(void)
 {
     /* Probe UNDI information */
@@ -246,6 +294,14 @@ void probe_undi(void)
 	   pxe_undi_iface.IfaceType, pxe_undi_iface.ServiceFlags);
 }
 
+/**
+ * The MTU of the link, as reported by UNDI, or 0 if unknown.
+ */
+unsigned int net_mtu(void)
+{
+    return pxe_undi_info.MaxTranUnit;
+}
+
 int core_tcp_open(struct pxe_pvt_inode *socket)
 {
     socket->net.lwip.conn = netconn_new(NETCONN_TCP);
@@ -1,12 +1,41 @@
 #include <syslinux/sysappend.h>
 #include <ctype.h>
+#include <minmax.h>
 #include <lwip/api.h>
+#ifdef __FIRMWARE_BIOS__
+# include <thread.h>
+#endif
 #include "pxe.h"
 #include "version.h"
 #include "url.h"
 #include "net.h"
 
 #define HTTP_PORT	80
+#define HTTP_POOL_SIZE	4	/* Idle connections kept for reuse */
+#define HTTP_DRAIN_MAX	65536	/* Largest unwanted body to read off */
+
+/* How much of the response body is still to come */
+enum http_body {
+    HTTP_RAW,			/* Header, or a body ending with the connection */
+    HTTP_DATA,			/* http_left bytes of Content-Length body */
+    HTTP_CHUNK_SIZE,		/* Chunk size line */
+    HTTP_CHUNK_EXT,		/* Rest of the chunk size line */
+    HTTP_CHUNK_DATA,		/* http_left bytes of chunk data */
+    HTTP_CHUNK_END,		/* CRLF after the chunk data */
+    HTTP_TRAILER,		/* Trailer; http_left is the line length */
+    HTTP_PARTS,			/* Reading the ranges in http_par */
+    HTTP_DONE,			/* Body complete */
+};
+
+/*
+ * Connections whose last response was read in full, ready for the next
+ * request to the same server.
+ */
+static struct http_idle {
+    uint32_t ip;		/* Server, 0 if the slot is free */
+    uint16_t port;
+    union net_private net;
+} http_pool[HTTP_POOL_SIZE];
 
 static bool is_tspecial(int ch)
 {
@@ -47,9 +76,56 @@ static bool append_ch(char *str, size_t size, size_t *pos, int ch)
     return success;
 }
 
+/* Does a comma-separated header value contain token? */
+static bool http_has_token(const char *value, const char *token)
+{
+    size_t len = strlen(token);
+
+    for (;;) {
+	while (isspace(*value) || *value == ',')
+	    value++;
+	if (!*value)
+	    return false;
+	if (!strncasecmp(value, token, len) &&
+	    (!value[len] || value[len] == ',' || isspace(value[len])))
+	    return true;
+	while (*value && *value != ',')
+	    value++;
+    }
+}
+
+/* Is a Content-Range value "bytes a-b/total" exactly the range asked for? */
+static bool http_range_matches(const char *value, uint32_t start, uint32_t len)
+{
+    unsigned long first, last;
+    char *end;
+
+    while (isspace(*value))
+	value++;
+    if (strncasecmp(value, "bytes", 5) || !isspace(value[5]))
+	return false;
+    value += 5;
+    while (isspace(*value))
+	value++;
+
+    first = strtoul(value, &end, 10);
+    if (end == value || *end != '-')
+	return false;
+    value = end + 1;
+    last = strtoul(value, &end, 10);
+    if (end == value || *end != '/')
+	return false;
+
+    return first == start && last == start + len - 1;
+}
+
 static size_t cookie_len, header_len;
 static char *cookie_buf, *header_buf;
 
+static void __http_open(struct url_info *url, struct inode *inode,
+			const char **redir, char *req,
+			uint32_t range_start, uint32_t range_len);
+
 __export uint32_t SendCookies = UINT_MAX; /* Send all cookies */
 
 static size_t http_do_bake_cookies(char *q)
@@ -146,14 +222,480 @@ __export void http_bake_cookies(void)
     http_do_bake_cookies(cookie_buf);
 }
 
+/*
+ * A single TCP connection moves at most one window per round trip,
+ * which is what limits a large file from a distant server.  Such a
+ * file is split into ranges fetched over connections of their own.
+ * The first range is read off the connection that asked for the whole
+ * file; each of the others is fetched into memory by its own thread,
+ * and handed out once the reader gets to it.
+ */
+#define HTTP_PARTS_MAX		4		/* Connections per file */
+#define HTTP_PARTS_MIN_SIZE	(4 << 20)	/* Smallest file to split */
+#define HTTP_PART_SLICE		32768		/* Handed out at a time */
+
+#ifdef __FIRMWARE_BIOS__
+
+struct http_part {
+    struct http_parallel *par;
+    struct inode *inode;	/* Connection for this range */
+    struct semaphore done;	/* Up when the thread is finished */
+    bool waited;		/* ... and the reader knows it */
+    char *req;			/* Request buffer */
+    char *buf;			/* The range as received */
+    uint32_t start, len;
+    uint32_t got;		/* Bytes in buf */
+};
+
+struct http_parallel {
+    struct url_info url;	/* With our own copies of host and path */
+    volatile bool abort;	/* File closed before the end */
+    int cur;			/* Part being read */
+    uint32_t pos;		/* Read position in it */
+    struct http_part part[HTTP_PARTS_MAX - 1];
+};
+
+/*
+ * Fetch whatever is still missing of a range.  This runs in the part's
+ * own thread, and once more in the reader's if that came up short.
+ */
+static void http_part_fetch(struct http_part *part)
+{
+    struct inode *inode = part->inode;
+    struct pxe_pvt_inode *socket = PVT(inode);
+    const char *redir = NULL;
+    uint32_t n;
+
+    memset(socket, 0, sizeof *socket);
+    __http_open(&part->par->url, inode, &redir, part->req,
+		part->start + part->got, part->len - part->got);
+    if (!inode->size)
+	return;
+
+    /* The pool is not safe to share between threads */
+    socket->http_keepalive = false;
+
+    while (part->got < part->len && !part->par->abort) {
+	if (!socket->tftp_bytesleft) {
+	    if (socket->tftp_goteof)
+		break;
+	    socket->ops->fill_buffer(inode);
+	    continue;
+	}
+	n = min((uint32_t)socket->tftp_bytesleft, part->len - part->got);
+	memcpy(part->buf + part->got, socket->tftp_dataptr, n);
+	socket->tftp_dataptr += n;
+	socket->tftp_bytesleft -= n;
+	part->got += n;
+    }
+
+    if (!socket->tftp_goteof)
+	socket->ops->close(inode);
+}
+
+static void http_part_thread(void *arg)
+{
+    struct http_part *part = arg;
+
+    http_part_fetch(part);
+    sem_up(&part->done);
+}
+
+static void http_parallel_free(struct http_parallel *par)
+{
+    struct http_part *part;
+
+    for (part = par->part; part < &par->part[HTTP_PARTS_MAX - 1]; part++) {
+	free(part->buf);
+	free(part->req);
+	if (part->inode)
+	    free_socket(part->inode);
+    }
+    free(par->url.host);
+    free(par->url.path);
+    free(par);
+}
+
+/*
+ * Start fetching all but the first range of a file of size bytes.
+ * Returns the length of the first range, which the caller reads off
+ * its own connection; if the file cannot be split that is all of it.
+ */
+static uint32_t http_parallel_start(struct inode *inode,
+				    const struct url_info *url, uint32_t size)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    struct http_parallel *par;
+    struct http_part *part;
+    uint32_t len = size / HTTP_PARTS_MAX;
+    size_t spare;
+    void *probe;
+
+    par = zalloc(sizeof *par);
+    if (!par)
+	return size;
+
+    par->url.host = strdup(url->host);
+    par->url.path = strdup(url->path);
+    par->url.ip = url->ip;
+    par->url.port = url->port;
+    if (!par->url.host || !par->url.path)
+	goto nomem;
+
+    for (part = par->part; part < &par->part[HTTP_PARTS_MAX - 1]; part++) {
+	part->par = par;
+	part->start = len * (part - par->part + 1);
+	part->len = len;
+	part->buf = malloc(len);
+	part->req = malloc(header_len);
+	part->inode = alloc_inode(inode->fs, 0, sizeof(struct pxe_pvt_inode));
+	if (!part->buf || !part->req || !part->inode)
+	    goto nomem;
+	part->inode->mode = DT_REG;
+	sem_init(&part->done, 0);
+    }
+
+    /* The last range takes the odd bytes */
+    part--;
+    part->len = size - part->start;
+    free(part->buf);
+    part->buf = malloc(part->len);
+    if (!part->buf)
+	goto nomem;
+
+    /*
+     * The ranges hold most of the file until the reader gets to them,
+     * on top of wherever the reader puts it; only split if the heap
+     * has room for the file and half as much again besides.
+     */
+    spare = (size_t)size + size / 2;
+    if (spare < size)
+	goto nomem;
+    probe = malloc(spare);
+    if (!probe)
+	goto nomem;
+    free(probe);
+
+    for (part = par->part; part < &par->part[HTTP_PARTS_MAX - 1]; part++) {
+	/* If there is no thread, the reader fetches the range itself */
+	if (!start_thread("http range", 16384, 0, http_part_thread, part))
+	    sem_up(&part->done);
+    }
+
+    socket->http_par = par;
+    return len;
+
+nomem:
+    http_parallel_free(par);
+    return size;
+}
+
+/*
+ * Stop any part threads still running and drop the ranges.
+ */
+static void http_parallel_stop(struct pxe_pvt_inode *socket)
+{
+    struct http_parallel *par = socket->http_par;
+    struct http_part *part;
+
+    if (!par)
+	return;
+
+    par->abort = true;
+    for (part = par->part; part < &par->part[HTTP_PARTS_MAX - 1]; part++) {
+	if (!part->waited)
+	    sem_down(&part->done, 0);
+    }
+
+    http_parallel_free(par);
+    socket->http_par = NULL;
+}
+
+/*
+ * Hand out the ranges after the first, in order, as they come in.
+ */
+static void http_parallel_fill(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    struct http_parallel *par = socket->http_par;
+    struct http_part *part;
+    uint32_t n;
+
+    /* The rest of the whole-file response is not wanted */
+    core_tcp_close_file(inode);
+
+    while (par->cur < HTTP_PARTS_MAX - 1) {
+	part = &par->part[par->cur];
+	if (!part->waited) {
+	    sem_down(&part->done, 0);
+	    part->waited = true;
+	    if (part->got < part->len)
+		http_part_fetch(part);
+	}
+
+	if (par->pos < part->got) {
+	    n = min(part->got - par->pos, (uint32_t)HTTP_PART_SLICE);
+	    socket->tftp_dataptr = part->buf + par->pos;
+	    socket->tftp_bytesleft = n;
+	    socket->tftp_filepos += n;
+	    par->pos += n;
+	    return;
+	}
+
+	if (part->got < part->len)
+	    break;		/* Lost, the file is short */
+
+	free(part->buf);
+	part->buf = NULL;
+	par->cur++;
+	par->pos = 0;
+    }
+
+    socket->tftp_goteof = 1;
+    if (inode->size == (uint64_t)-1)
+	inode->size = socket->tftp_filepos;
+    socket->ops->close(inode);
+}
+#else
+/* EFI is single-threaded, so a file always comes over one connection */
+static inline uint32_t http_parallel_start(struct inode *inode,
+					   const struct url_info *url,
+					   uint32_t size)
+{
+    (void)inode;
+    (void)url;
+    return size;
+}
+#endif /* __FIRMWARE_BIOS__ */
+
+static bool http_pool_get(struct pxe_pvt_inode *socket)
+{
+    struct http_idle *idle;
+
+    for (idle = http_pool; idle < &http_pool[HTTP_POOL_SIZE]; idle++) {
+	if (idle->ip == socket->http_ip &&
+	    idle->port == socket->tftp_remoteport) {
+	    socket->net = idle->net;
+	    idle->ip = 0;
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+static bool http_pool_put(struct pxe_pvt_inode *socket)
+{
+    struct http_idle *idle;
+
+    for (idle = http_pool; idle < &http_pool[HTTP_POOL_SIZE]; idle++) {
+	if (!idle->ip) {
+	    idle->ip = socket->http_ip;
+	    idle->port = socket->tftp_remoteport;
+	    idle->net = socket->net;
+	    memset(&socket->net, 0, sizeof socket->net);
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+/*
+ * A connection is only worth keeping if the whole response has been
+ * read off it, so that the next response starts at its first byte.
+ */
+static void http_close_file(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+
+#ifdef __FIRMWARE_BIOS__
+    http_parallel_stop(socket);
+#endif
+
+    if (socket->http_body == HTTP_DONE && !socket->http_rawleft &&
+	socket->http_keepalive && http_pool_put(socket))
+	return;
+
+    core_tcp_close_file(inode);
+}
+
+/*
+ * Get the next piece of the response off the connection, for
+ * http_fill_buffer() to decode.
+ */
+static bool http_get_raw(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+
+    core_tcp_fill_buffer(inode);
+    if (socket->tftp_goteof)
+	return false;
+
+    socket->http_rawptr = socket->tftp_dataptr;
+    socket->http_rawleft = socket->tftp_bytesleft;
+    socket->tftp_filepos -= socket->tftp_bytesleft;
+    socket->tftp_bytesleft = 0;
+    return true;
+}
+
+/*
+ * Hand out the next piece of the response body.  With a persistent
+ * connection the end of the body has to be found from Content-Length
+ * or the chunked encoding, since the server will not close the
+ * connection to mark it.
+ */
+static void http_fill_buffer(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    uint16_t n;
+    uint8_t ch;
+
+    if (socket->http_body == HTTP_RAW) {
+	core_tcp_fill_buffer(inode);
+	return;
+    }
+#ifdef __FIRMWARE_BIOS__
+    if (socket->http_body == HTTP_PARTS) {
+	http_parallel_fill(inode);
+	return;
+    }
+#endif
+
+    while (socket->http_body != HTTP_DONE) {
+	if (!socket->http_rawleft) {
+	    if (!http_get_raw(inode))
+		return;		/* Connection lost, the file is short */
+	    continue;
+	}
+
+	if (socket->http_body == HTTP_DATA ||
+	    socket->http_body == HTTP_CHUNK_DATA) {
+	    n = socket->http_rawleft;
+	    if (n > socket->http_left)
+		n = socket->http_left;
+	    socket->tftp_dataptr = socket->http_rawptr;
+	    socket->tftp_bytesleft = n;
+	    socket->tftp_filepos += n;
+	    socket->http_rawptr += n;
+	    socket->http_rawleft -= n;
+	    socket->http_left -= n;
+	    if (!socket->http_left) {
+		if (socket->http_body == HTTP_CHUNK_DATA)
+		    socket->http_body = HTTP_CHUNK_END;
+		else
+		    socket->http_body = socket->http_par ?
+			HTTP_PARTS : HTTP_DONE;
+	    }
+	    return;
+	}
+
+	ch = *socket->http_rawptr++;
+	socket->http_rawleft--;
+
+	switch (socket->http_body) {
+	case HTTP_CHUNK_SIZE:
+	    if (isxdigit(ch)) {
+		if (socket->http_left >> 28) {
+		    printf("http: chunk too large\n");
+		    socket->http_keepalive = false;
+		    socket->http_body = HTTP_DONE;
+		    break;
+		}
+		socket->http_left <<= 4;
+		socket->http_left += ch <= '9' ? ch - '0' : (ch | 0x20) - 'a' + 10;
+		break;
+	    }
+	    socket->http_body = HTTP_CHUNK_EXT;
+	    /* fall through */
+	case HTTP_CHUNK_EXT:
+	    /* Chunk extensions are ignored */
+	    if (ch == '\n')
+		socket->http_body = socket->http_left ?
+		    HTTP_CHUNK_DATA : HTTP_TRAILER;
+	    break;
+	case HTTP_CHUNK_END:
+	    if (ch == '\n') {
+		socket->http_body = HTTP_CHUNK_SIZE;
+		socket->http_left = 0;
+	    }
+	    break;
+	case HTTP_TRAILER:
+	    /* Trailer fields are ignored, an empty line ends the body */
+	    if (ch == '\n') {
+		if (!socket->http_left)
+		    socket->http_body = HTTP_DONE;
+		socket->http_left = 0;
+	    } else if (ch != '\r') {
+		socket->http_left++;
+	    }
+	    break;
+	}
+    }
+
+    socket->tftp_goteof = 1;
+    if (inode->size == (uint64_t)-1)
+	inode->size = socket->tftp_filepos;
+    socket->ops->close(inode);
+}
+
 static const struct pxe_conn_ops http_conn_ops = {
-    .fill_buffer	= core_tcp_fill_buffer,
-    .close		= core_tcp_close_file,
+    .fill_buffer	= http_fill_buffer,
+    .close		= http_close_file,
     .readdir		= http_readdir,
 };
 
-void http_open(struct url_info *url, int flags, struct inode *inode,
-	       const char **redir)
+/*
+ * Read off and throw away the body of a response we are not going to
+ * use, such as an error page or a redirect, so that the connection can
+ * go back to the pool.  Returns false, with the connection still open,
+ * if the body is not worth waiting for.
+ */
+static bool http_drain(struct inode *inode, bool chunked,
+		       uint32_t content_length)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+
+    if (!socket->http_keepalive)
+	return false;
+
+    if (chunked) {
+	socket->http_body = HTTP_CHUNK_SIZE;
+	socket->http_left = 0;
+    } else if (content_length <= HTTP_DRAIN_MAX) {
+	socket->http_body = content_length ? HTTP_DATA : HTTP_DONE;
+	socket->http_left = content_length;
+    } else {
+	return false;
+    }
+
+    socket->http_rawptr = socket->tftp_dataptr;
+    socket->http_rawleft = socket->tftp_bytesleft;
+    socket->tftp_filepos = 0;
+    socket->tftp_bytesleft = 0;
+
+    /* This closes the connection, or pools it, at the end of the body */
+    while (!socket->tftp_goteof) {
+	if (socket->tftp_filepos > HTTP_DRAIN_MAX) {
+	    socket->http_keepalive = false;
+	    http_close_file(inode);
+	    break;
+	}
+	socket->tftp_bytesleft = 0;
+	http_fill_buffer(inode);
+    }
+
+    return true;
+}
+
+/*
+ * Send a GET for url, or for range_len bytes of it from range_start,
+ * and read the response header.  req is the buffer for the request,
+ * which must stay untouched until the connection is closed.
+ */
+static void __http_open(struct url_info *url, struct inode *inode,
+			const char **redir, char *req,
+			uint32_t range_start, uint32_t range_len)
 {
     struct pxe_pvt_inode *socket = PVT(inode);
     int header_bytes;
@@ -175,81 +717,99 @@ void http_open(struct url_info *url, int flags, struct inode *inode,
     static char location[FILENAME_MAX];
     uint32_t content_length; /* same as inode->size */
     size_t response_size;
+    char range[40];
+    bool chunked;
+    bool ranges;
+    bool range_ok;
+    bool reused;
     int status;
     int pos;
     int err;
 
-    (void)flags;
-
-    if (!header_buf)
-	return;			/* http is broken... */
-
-    /* This is a straightforward TCP connection after headers */
     socket->ops = &http_conn_ops;
 
+    if (!url->port)
+	url->port = HTTP_PORT;
+    socket->http_ip = url->ip;
+    socket->tftp_remoteport = url->port;
+
+reconnect:
     /* Reset all of the variables */
-    inode->size = content_length = -1;
+    inode->size = -1;
+    content_length = -1;
+    socket->http_body = HTTP_RAW;
+    socket->http_rawleft = 0;
+    socket->http_keepalive = false;
+    response_size = 0;
 
-    /* Start the http connection */
-    err = core_tcp_open(socket);
-    if (err)
-        return;
+    reused = !range_len && http_pool_get(socket);
+    if (!reused) {
+	/* Start the http connection */
+	err = core_tcp_open(socket);
+	if (err)
+	    return;
 
-    if (!url->port)
-	url->port = HTTP_PORT;
+	err = core_tcp_connect(socket, url->ip, url->port);
+	if (err)
+	    goto fail;
+    }
 
-    err = core_tcp_connect(socket, url->ip, url->port);
-    if (err)
-	goto fail;
+    range[0] = '\0';
+    if (range_len)
+	snprintf(range, sizeof range, "Range: bytes=%u-%u\r\n",
+		 range_start, range_start + range_len - 1);
 
-    strcpy(header_buf, "GET /");
+    strcpy(req, "GET /");
     header_bytes = 5;
-    header_bytes += url_escape_unsafe(header_buf+5, url->path,
+    header_bytes += url_escape_unsafe(req+5, url->path,
 				      header_len - 5);
     if (header_bytes >= header_len)
 	goto fail;		/* Buffer overflow */
-    header_bytes += snprintf(header_buf + header_bytes,
+    header_bytes += snprintf(req + header_bytes,
 			     header_len - header_bytes,
-			     " HTTP/1.0\r\n"
+			     " HTTP/1.1\r\n"
 			     "Host: %s",
 			     url->host);
     if (header_bytes >= header_len)
 	goto fail;		/* Buffer overflow */
     if (url->port != HTTP_PORT) {
-	header_bytes += snprintf(header_buf + header_bytes,
+	header_bytes += snprintf(req + header_bytes,
 			     header_len - header_bytes,
 			     ":%d", url->port);
 	if (header_bytes >= header_len)
 	    goto fail;		/* Buffer overflow */
     }
-    header_bytes += snprintf(header_buf + header_bytes,
+    header_bytes += snprintf(req + header_bytes,
 			     header_len - header_bytes,
 			     "\r\n"
 			     "User-Agent: Syslinux/" VERSION_STR "\r\n"
-			     "Connection: close\r\n"
-			     "%s"
+			     "%s%s"
 			     "\r\n",
-			     cookie_buf ? cookie_buf : "");
+			     range, cookie_buf ? cookie_buf : "");
     if (header_bytes >= header_len)
 	goto fail;		/* Buffer overflow */
 
-    err = core_tcp_write(socket, header_buf, header_bytes, false);
+    err = core_tcp_write(socket, req, header_bytes, false);
     if (err)
-	goto fail;
+	goto retry;
 
     /* Parse the HTTP header */
     state = st_httpver;
     pos = 0;
     status = 0;
-    response_size = 0;
+    chunked = false;
+    ranges = false;
+    range_ok = false;
     field_value_len = 0;
+    field_value[0] = '\0';
     field_name_len = 0;
+    field_name[0] = '\0';
 
     while (state != st_eoh) {
 	int ch = pxe_getc(inode);
 	/* Eof before I finish paring the header */
 	if (ch == -1)
-	    goto fail;
+	    goto retry;
 #if 0
         printf("%c", ch);
 #endif
@@ -259,8 +819,14 @@ void http_open(struct url_info *url, int flags, struct inode *inode,
 	switch (state) {
 	case st_httpver:
 	    if (ch == ' ') {
+		/* HTTP/1.1 connections are persistent unless we hear otherwise */
+		socket->http_keepalive = !strcmp(field_value, "HTTP/1.1");
+		field_value_len = 0;
+		field_value[0] = '\0';
 		state = st_stcode;
 		pos = 0;
+	    } else {
+		append_ch(field_value, sizeof field_value, &field_value_len, ch);
 	    }
 	    break;
 
@@ -278,39 +844,60 @@ void http_open(struct url_info *url, int flags, struct inode *inode,
 	    break;
 
 	case st_fieldfirst:
-	    if (ch == '\n')
-		state = st_eoh;
-	    else if (isspace(ch)) {
+	    if (ch != '\n' && isspace(ch)) {
 		/* A continuation line */
 		state = st_fieldvalue;
 		goto fieldvalue;
 	    }
-	    else if (is_token(ch)) {
-		/* Process the previous field before starting on the next one */
-		if (strcasecmp(field_name, "Content-Length") == 0) {
-		    next = field_value;
-		    /* Skip leading whitespace */
-		    while (isspace(*next))
-			next++;
-		    content_length = 0;
-		    for (;(*next >= '0' && *next <= '9'); next++) {
-			if ((content_length * 10) < content_length)
-			    break;
-			content_length = (content_length * 10) + (*next - '0');
-		    }
-		    /* In the case of overflow or other error ignore
-		     * Content-Length.
-		     */
-		    if (*next)
-			content_length = -1;
-		}
-		else if (strcasecmp(field_name, "Location") == 0) {
-		    next = field_value;
-		    /* Skip leading whitespace */
-		    while (isspace(*next))
-			next++;
-		    strlcpy(location, next, sizeof location);
+	    /*
+	     * Process the previous field before starting on the next one,
+	     * or before the end of the header.
+	     */
+	    if (strcasecmp(field_name, "Content-Length") == 0) {
+		next = field_value;
+		/* Skip leading whitespace */
+		while (isspace(*next))
+		    next++;
+		content_length = 0;
+		for (;(*next >= '0' && *next <= '9'); next++) {
+		    if ((content_length * 10) < content_length)
+			break;
+		    content_length = (content_length * 10) + (*next - '0');
 		}
+		/* In the case of overflow or other error ignore
+		 * Content-Length.
+		 */
+		if (*next)
+		    content_length = -1;
+	    }
+	    else if (strcasecmp(field_name, "Location") == 0) {
+		next = field_value;
+		/* Skip leading whitespace */
+		while (isspace(*next))
+		    next++;
+		strlcpy(location, next, sizeof location);
+	    }
+	    else if (strcasecmp(field_name, "Transfer-Encoding") == 0) {
+		chunked = http_has_token(field_value, "chunked");
+	    }
+	    else if (strcasecmp(field_name, "Accept-Ranges") == 0) {
+		ranges = http_has_token(field_value, "bytes");
+	    }
+	    else if (strcasecmp(field_name, "Content-Range") == 0) {
+		range_ok = range_len &&
+		    http_range_matches(field_value, range_start, range_len);
+	    }
+	    else if (strcasecmp(field_name, "Connection") == 0) {
+		if (http_has_token(field_value, "close"))
+		    socket->http_keepalive = false;
+		else if (http_has_token(field_value, "keep-alive"))
+		    socket->http_keepalive = true;
+	    }
+	    field_name[0] = '\0';
+
+	    if (ch == '\n')
+		state = st_eoh;
+	    else if (is_token(ch)) {
 		/* Start the field name and field value afress */
 		field_name_len = 1;
 		field_name[0] = ch;
@@ -375,6 +962,13 @@ void http_open(struct url_info *url, int flags, struct inode *inode,
     if (state != st_eoh)
 	status = 0;
 
+    /*
+     * A range only comes as 206, and only with a Content-Range saying
+     * it is the one asked for; a 200 would be the whole file.
+     */
+    if (range_len)
+	status = (status == 206 && range_ok) ? 200 : 0;
+
     switch (status) {
     case 200:
 	/*
@@ -383,23 +977,71 @@ void http_open(struct url_info *url, int flags, struct inode *inode,
 	 */
 	/* Treat the remainder of the bytes as data */
 	socket->tftp_filepos -= response_size;
+	if (chunked) {
+	    socket->http_body = HTTP_CHUNK_SIZE;
+	    socket->http_left = 0;
+	} else if (content_length != (uint32_t)-1) {
+	    socket->http_body = content_length ? HTTP_DATA : HTTP_DONE;
+	    socket->http_left = content_length;
+	    if (ranges && !range_len && content_length >= HTTP_PARTS_MIN_SIZE)
+		socket->http_left = http_parallel_start(inode, url,
+							content_length);
+	} else {
+	    /* The body runs until the server closes the connection */
+	    socket->http_keepalive = false;
+	    break;
+	}
+	/* ... but it has to be decoded first */
+	socket->http_rawptr = socket->tftp_dataptr;
+	socket->http_rawleft = socket->tftp_bytesleft;
+	socket->tftp_filepos = 0;
+	socket->tftp_bytesleft = 0;
 	break;
     case 301:
     case 302:
     case 303:
     case 307:
 	/* A redirect */
-	if (!location[0])
-	    goto fail;
-	*redir = location;
-	goto fail;
+	if (location[0])
+	    *redir = location;
+	goto drain;
     default:
-	goto fail;
-	break;
+	goto drain;
     }
     return;
+drain:
+    /* Ranges are fetched by threads, which must not use the pool */
+    if (!range_len && http_drain(inode, chunked, content_length)) {
+	inode->size = 0;
+	return;
+    }
+    goto fail;
+retry:
+    /*
+     * The server is free to close an idle connection at any time, so
+     * a reused one failing before the response starts is no error.
+     */
+    if (reused && !response_size) {
+	if (!socket->tftp_goteof)
+	    core_tcp_close_file(inode);
+	socket->tftp_goteof = 0;
+	socket->tftp_filepos = 0;
+	socket->tftp_bytesleft = 0;
+	goto reconnect;
+    }
 fail:
     inode->size = 0;
     core_tcp_close_file(inode);
     return;
 }
+
+void http_open(struct url_info *url, int flags, struct inode *inode,
+	       const char **redir)
+{
+    (void)flags;
+
+    if (!header_buf)
+	return;			/* http is broken... */
+
+    __http_open(url, inode, redir, header_buf, 0, 0);
+}
@@ -108,6 +108,8 @@ struct bootp_t {
 struct netconn;
 struct netbuf;
 struct efi_binding;
+struct tftp_mcast;
+struct http_parallel;
 
 /*
  * Our inode private information -- this includes the packet buffer!
@@ -142,9 +144,20 @@ struct pxe_pvt_inode {
     uint16_t tftp_lastpkt;        /* Sequence number of last packet (HBO) */
     char    *tftp_dataptr;        /* Pointer to available data */
     uint8_t  tftp_goteof;         /* 1 if the EOF packet received */
-    uint8_t  tftp_unused[3];      /* Currently unused */
+    uint8_t  tftp_unused[1];      /* Currently unused */
+    uint16_t tftp_windowsize;     /* Packets per ACK (RFC 7440), 1 = lock-step */
+    uint16_t tftp_lastack;        /* Sequence number of last packet ACKed */
+    uint16_t *tftp_held;          /* Lengths of packets held out of order */
     char    *tftp_pktbuf;         /* Packet buffer */
+    struct tftp_mcast *tftp_mcast; /* Multicast (RFC 2090) state */
     struct inode *ctl;	          /* Control connection (for FTP) */
+    char    *http_rawptr;         /* HTTP: received but not yet decoded */
+    uint16_t http_rawleft;        /* HTTP: bytes at http_rawptr */
+    uint8_t  http_body;           /* HTTP: body decoding state */
+    uint8_t  http_keepalive;      /* HTTP: connection may be reused */
+    uint32_t http_left;           /* HTTP: bytes left in body or chunk */
+    uint32_t http_ip;             /* HTTP: server, for connection reuse */
+    struct http_parallel *http_par; /* HTTP: ranges fetched alongside */
     const struct pxe_conn_ops *ops;
 };
 
@@ -241,6 +254,8 @@ void pxe_idle_cleanup(void);
 /* tftp.c */
 void tftp_open(struct url_info *url, int flags, struct inode *inode,
 	       const char **redir);
+void mtftp_open(struct url_info *url, int flags, struct inode *inode,
+		const char **redir);
 
 /* gpxeurl.c */
 void gpxe_open(struct inode *inode, const char *url);
@@ -16,6 +16,7 @@ struct tftp_packet {
 
 static void tftp_error(struct inode *file, uint16_t errnum,
 		       const char *errstr);
+static void tftp_mcast_stop(struct pxe_pvt_inode *socket);
 
 static void tftp_close_file(struct inode *inode)
 {
@@ -23,6 +24,7 @@ static void tftp_close_file(struct inode *inode)
     if (!socket->tftp_goteof) {
 	tftp_error(inode, 0, "No error, file close");
     }
+    tftp_mcast_stop(socket);
     core_udp_close(socket);
 }
 
@@ -71,36 +73,105 @@ static void ack_packet(struct inode *inode, uint16_t ack_num)
     core_udp_send(socket, ack_packet_buf, 4);
 }
 
+/*
+ * With a window (RFC 7440) the packet buffer also holds one slot per
+ * packet of the window, for packets that arrive ahead of their turn,
+ * followed by the lengths of the packets held in them.
+ */
+static inline size_t tftp_slot_size(const struct pxe_pvt_inode *socket)
+{
+    return (socket->tftp_blksize + 4 + 1) & ~1;
+}
+
+static inline struct tftp_packet *tftp_slot(struct pxe_pvt_inode *socket,
+					    unsigned int slot)
+{
+    return (struct tftp_packet *)
+	(socket->tftp_pktbuf + (slot + 1) * tftp_slot_size(socket));
+}
+
+static int tftp_alloc_pktbuf(struct pxe_pvt_inode *socket)
+{
+    size_t slot_size = tftp_slot_size(socket);
+    unsigned int slots = 0;
+
+    /* With fewer than 3 packets per window nothing can be held */
+    if (socket->tftp_windowsize > 2)
+	slots = socket->tftp_windowsize;
+
+    socket->tftp_pktbuf = malloc((slots + 1) * slot_size +
+				 slots * sizeof(uint16_t));
+    if (!socket->tftp_pktbuf)
+	return -1;
+
+    if (slots) {
+	socket->tftp_held = (uint16_t *)tftp_slot(socket, slots);
+	memset(socket->tftp_held, 0, slots * sizeof(uint16_t));
+    }
+
+    /* The first call to tftp_get_packet() ACKs the OACK or first DATA */
+    socket->tftp_lastack = socket->tftp_lastpkt - socket->tftp_windowsize;
+
+    return 0;
+}
+
+static void tftp_ack(struct inode *inode, uint16_t ack_num)
+{
+    PVT(inode)->tftp_lastack = ack_num;
+    ack_packet(inode, ack_num);
+}
+
 /*
  * Get a fresh packet if the buffer is drained, and we haven't hit
  * EOF yet.  The buffer should be filled immediately after draining!
+ *
+ * The server sends tftp_windowsize packets per ACK; one is sent for
+ * the last packet of each window, and for the last packet received in
+ * order whenever a gap shows up or nothing arrives for a while, after
+ * which the server resends from the packet following it.  Packets that
+ * arrive ahead of a gap are held and used when their turn comes.
  */
 static void tftp_get_packet(struct inode *inode)
 {
-    uint16_t last_pkt;
+    uint16_t next_pkt;
     const uint8_t *timeout_ptr;
     uint8_t timeout;
     uint16_t buffersize;
     uint16_t serial;
+    uint16_t ahead;
     jiffies_t oldtime;
     struct tftp_packet *pkt = NULL;
     uint16_t buf_len;
     struct pxe_pvt_inode *socket = PVT(inode);
+    const uint16_t windowsize = socket->tftp_windowsize;
+    unsigned int slot;
     uint16_t src_port;
     uint32_t src_ip;
     int err;
 
     /*
-     * Start by ACKing the previous packet; this should cause
-     * the next packet to be sent.
+     * Start by ACKing the previous window if that is still owed; this
+     * should cause the next one to be sent.
      */
+    if ((uint16_t)(socket->tftp_lastpkt - socket->tftp_lastack) >= windowsize)
+	tftp_ack(inode, socket->tftp_lastpkt);
+
+    next_pkt = socket->tftp_lastpkt + 1;
+
+    /* Maybe it already arrived, ahead of a packet that was lost */
+    if (socket->tftp_held) {
+	slot = next_pkt % windowsize;
+	buf_len = socket->tftp_held[slot];
+	socket->tftp_held[slot] = 0;
+	pkt = tftp_slot(socket, slot);
+	if (buf_len && ntohs(pkt->serial) == next_pkt)
+	    goto got_packet;
+    }
+
     timeout_ptr = TimeoutTable;
     timeout = *timeout_ptr++;
     oldtime = jiffies();
 
- ack_again:
-    ack_packet(inode, socket->tftp_lastpkt);
-
     while (timeout) {
 	buf_len = socket->tftp_blksize + 4;
 	err = core_udp_recv(socket, socket->tftp_pktbuf, &buf_len,
@@ -113,7 +184,7 @@ static void tftp_get_packet(struct inode *inode)
 		timeout = *timeout_ptr++;
 		if (!timeout)
 		    break;
-		goto ack_again;
+		tftp_ack(inode, socket->tftp_lastpkt);
 	    }
             continue;
 	}
@@ -125,44 +196,61 @@ static void tftp_get_packet(struct inode *inode)
         if (pkt->opcode != TFTP_DATA)    /* Not a data packet */
             continue;
 
-        /* If goes here, recevie OK, break */
-        break;
-    }
+	serial = ntohs(pkt->serial);
+	if (serial == next_pkt)
+	    goto got_packet;	/* recevie OK */
 
-    /* time runs out */
-    if (timeout == 0)
-	kaboom();
+	ahead = serial - next_pkt;
+	if (ahead < windowsize) {
+	    /*
+	     * A later packet of this window.  Hold it unless its slot
+	     * is the one whose data we handed out last.
+	     */
+	    if (socket->tftp_held && ahead < windowsize - 1) {
+		slot = serial % windowsize;
+		memcpy(tftp_slot(socket, slot), pkt, buf_len);
+		socket->tftp_held[slot] = buf_len;
+	    }
 
-    last_pkt = socket->tftp_lastpkt;
-    last_pkt++;
-    serial = ntohs(pkt->serial);
-    if (serial != last_pkt) {
-        /*
-         * Wrong packet, ACK the packet and try again.
-         * This is presumably because the ACK got lost,
-         * so the server just resent the previous packet.
-         */
+	    /* The window is over with a gap in it: ask for a resend */
+	    if (serial == (uint16_t)(socket->tftp_lastack + windowsize) ||
+		buf_len - 4 < socket->tftp_blksize)
+		tftp_ack(inode, socket->tftp_lastpkt);
+	} else if (serial == socket->tftp_lastack) {
+	    /*
+	     * The end of a window we already have.  This is presumably
+	     * because the ACK got lost, so the server resent the window.
+	     */
 #if 0
-	printf("Wrong packet, wanted %04x, got %04x\n", \
-               htons(last_pkt), htons(*(uint16_t *)(data+2)));
+	    printf("Wrong packet, wanted %04x, got %04x\n", \
+		   next_pkt, serial);
 #endif
-        goto ack_again;
+	    tftp_ack(inode, serial);
+	}
     }
 
+    /* time runs out */
+    kaboom();
+
+got_packet:
     /* It's the packet we want.  We're also EOF if the size < blocksize */
-    socket->tftp_lastpkt = last_pkt;    /* Update last packet number */
+    serial = next_pkt;
+    socket->tftp_lastpkt = serial;	/* Update last packet number */
     buffersize = buf_len - 4;		/* Skip TFTP header */
-    socket->tftp_dataptr = socket->tftp_pktbuf + 4;
+    socket->tftp_dataptr = pkt->data;
     socket->tftp_filepos += buffersize;
     socket->tftp_bytesleft = buffersize;
     if (buffersize < socket->tftp_blksize) {
         /* it's the last block, ACK packet immediately */
-        ack_packet(inode, serial);
+        tftp_ack(inode, serial);
 
         /* Make sure we know we are at end of file */
         inode->size 		= socket->tftp_filepos;
         socket->tftp_goteof	= 1;
         tftp_close_file(inode);
+    } else if ((uint16_t)(serial - socket->tftp_lastack) >= windowsize) {
+	/* The last packet of the window; let the next one come */
+	tftp_ack(inode, serial);
     }
 }
 
@@ -171,19 +259,325 @@ const struct pxe_conn_ops tftp_conn_ops = {
     .close		= tftp_close_file,
 };
 
+/*
+ * Multicast TFTP (RFC 2090).  The server sends the file to a multicast
+ * group, and one of the clients receiving it, the master, ACKs each
+ * packet.  A client may join when the file is half way through, so
+ * packets are kept as they arrive, in a buffer for the whole file, and
+ * handed out in order.  When the master has the whole file it ACKs the
+ * last packet, and the server sends an OACK making another client the
+ * master, which ACKs the packet before the first one it is missing to
+ * have the server go back to it.  A client that hears nothing for a
+ * while sends its request again, and the server answers with an OACK
+ * saying whether it is now the master.
+ */
+struct tftp_mcast {
+    struct pxe_pvt_inode sock;	/* Socket receiving the group */
+    uint32_t server;		/* Server IP address */
+    uint16_t server_port;	/* Server port the request went to */
+    uint16_t rrq_len;		/* Length of the request */
+    char *rrq;			/* The request, to send again */
+    uint32_t group;		/* Group IP address */
+    uint32_t blocks;		/* Packets in the file */
+    uint32_t missing;		/* Packets not received yet */
+    uint32_t lowmiss;		/* No packet before this one is missing */
+    bool master;		/* We are the one ACKing the packets */
+    char *rxbuf;		/* Receive buffer, after the file data */
+    uint8_t have[];		/* Bitmap of the packets received */
+};
+
+static inline bool tftp_mcast_have(const struct tftp_mcast *mc,
+				   uint32_t serial)
+{
+    return mc->have[serial >> 3] & (1 << (serial & 7));
+}
+
+/*
+ * Parse the value of the "multicast" option, "addr,port,mc".  The
+ * address and port are left out of an OACK which only changes mc.
+ */
+static int tftp_mcast_option(const char *p, uint32_t *group,
+			     uint16_t *port, bool *master)
+{
+    uint32_t ip = 0, v;
+    int i;
+
+    if (*p != ',') {
+	for (i = 0; i < 4; i++) {
+	    if (!is_digit(*p))
+		return -1;
+	    for (v = 0; is_digit(*p); p++) {
+		v = v*10 + *p - '0';
+		if (v > 255)
+		    return -1;
+	    }
+	    if (*p != (i == 3 ? ',' : '.'))
+		return -1;
+	    p++;
+	    ip = (ip << 8) | v;
+	}
+	*group = htonl(ip);
+    } else {
+	p++;
+    }
+
+    if (*p != ',') {
+	for (v = 0; is_digit(*p); p++) {
+	    v = v*10 + *p - '0';
+	    if (v > 65535)
+		return -1;
+	}
+	if (!v || *p != ',')
+	    return -1;
+	*port = v;
+    }
+    p++;
+
+    if ((*p != '0' && *p != '1') || p[1])
+	return -1;
+    *master = *p == '1';
+
+    return 0;
+}
+
+/* ACK the packet before the first one we are missing */
+static void tftp_mcast_ack(struct inode *inode)
+{
+    struct tftp_mcast *mc = PVT(inode)->tftp_mcast;
+
+    while (mc->lowmiss <= mc->blocks && tftp_mcast_have(mc, mc->lowmiss))
+	mc->lowmiss++;
+
+    ack_packet(inode, mc->lowmiss - 1);
+}
+
+static void tftp_mcast_stop(struct pxe_pvt_inode *socket)
+{
+    struct tftp_mcast *mc = socket->tftp_mcast;
+
+    if (!mc)
+	return;
+
+    core_udp_leave(&mc->sock, mc->group);
+    core_udp_close(&mc->sock);
+    free(mc);
+    socket->tftp_mcast = NULL;
+}
+
+/*
+ * Receive one packet from the server.  DATA comes to the group; an OACK
+ * changing the master comes to our own port, and is only looked for
+ * when the group is quiet, as it is while the server waits for the new
+ * master.  Returns false if nothing came from the server.
+ */
+static bool tftp_mcast_recv(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    struct tftp_mcast *mc = socket->tftp_mcast;
+    struct tftp_packet *pkt = (struct tftp_packet *)mc->rxbuf;
+    uint16_t buf_len;
+    uint16_t src_port;
+    uint32_t src_ip;
+    uint32_t serial, len;
+    uint32_t group;
+    uint16_t port;
+    char *p, *end, *opt;
+
+    buf_len = socket->tftp_blksize + 4;
+    if (core_udp_recv(&mc->sock, pkt, &buf_len, &src_ip, &src_port)) {
+	buf_len = socket->tftp_blksize + 4;
+	if (core_udp_recv(socket, pkt, &buf_len, &src_ip, &src_port))
+	    return false;
+    }
+
+    if (src_ip != mc->server || buf_len < 4)
+	return false;
+
+    if (pkt->opcode == TFTP_OACK) {
+	p = mc->rxbuf + 2;
+	end = mc->rxbuf + buf_len;
+	*end = '\0';
+	while (p < end) {
+	    for (opt = p; *p; p++)
+		*p |= 0x20;
+	    if (++p >= end)
+		break;
+	    if (!strcmp(opt, "multicast"))
+		tftp_mcast_option(p, &group, &port, &mc->master);
+	    p += strlen(p) + 1;
+	}
+	if (mc->master)
+	    tftp_mcast_ack(inode);
+	return true;
+    }
+
+    if (pkt->opcode != TFTP_DATA)
+	return false;
+
+    serial = ntohs(pkt->serial);
+    len = buf_len - 4;
+    if (serial && serial <= mc->blocks && !tftp_mcast_have(mc, serial) &&
+	len == min(inode->size - (serial - 1) * socket->tftp_blksize,
+		   (uint64_t)socket->tftp_blksize)) {
+	memcpy(socket->tftp_pktbuf + (serial - 1) * socket->tftp_blksize,
+	       pkt->data, len);
+	mc->have[serial >> 3] |= 1 << (serial & 7);
+	mc->missing--;
+    }
+
+    if (!mc->missing) {
+	/* We are done; if we were the master, the server picks another */
+	ack_packet(inode, mc->blocks);
+	tftp_mcast_stop(socket);
+    } else if (mc->master) {
+	tftp_mcast_ack(inode);
+    }
+
+    return true;
+}
+
+/*
+ * Hand out the next packet of the file, waiting for it if it has not
+ * arrived yet.
+ */
+static void tftp_mcast_get_packet(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    struct tftp_mcast *mc;
+    const uint8_t *timeout_ptr = TimeoutTable;
+    uint8_t timeout = *timeout_ptr++;
+    jiffies_t oldtime = jiffies();
+    uint16_t serial = socket->tftp_lastpkt + 1;
+    uint32_t offset, len;
+
+    while (socket->tftp_mcast &&
+	   !tftp_mcast_have(socket->tftp_mcast, serial)) {
+	if (tftp_mcast_recv(inode)) {
+	    timeout_ptr = TimeoutTable;
+	    timeout = *timeout_ptr++;
+	    oldtime = jiffies();
+	} else if (jiffies() - oldtime >= timeout) {
+	    oldtime = jiffies();
+	    timeout = *timeout_ptr++;
+	    if (!timeout)
+		kaboom();
+	    mc = socket->tftp_mcast;
+	    if (mc->master)
+		tftp_mcast_ack(inode);
+	    else
+		core_udp_sendto(socket, mc->rrq, mc->rrq_len,
+				mc->server, mc->server_port);
+	}
+    }
+
+    offset = (serial - 1) * socket->tftp_blksize;
+    len = min(inode->size - offset, (uint64_t)socket->tftp_blksize);
+    socket->tftp_lastpkt = serial;
+    socket->tftp_dataptr = socket->tftp_pktbuf + offset;
+    socket->tftp_filepos += len;
+    socket->tftp_bytesleft = len;
+    if (len < socket->tftp_blksize) {
+	/* The last packet */
+	socket->tftp_goteof = 1;
+	tftp_close_file(inode);
+    }
+}
+
+static const struct pxe_conn_ops tftp_mcast_conn_ops = {
+    .fill_buffer	= tftp_mcast_get_packet,
+    .close		= tftp_close_file,
+};
+
+/*
+ * Follow the group the server sends the file to.  This needs the size
+ * of the file, and only works for up to 65535 packets, as the serial
+ * numbers of packets arriving out of order can't be unwrapped.
+ */
+static int tftp_mcast_start(struct inode *inode, const struct url_info *url,
+			    const char *rrq, int rrq_len,
+			    uint32_t group, uint16_t port, bool master)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    struct tftp_mcast *mc;
+    uint64_t blocks;
+
+    if (!group || !port || !inode->size || inode->size == (uint64_t)-1)
+	return -1;
+
+    blocks = inode->size / socket->tftp_blksize + 1;
+    if (blocks > 65535)
+	return -1;
+
+    mc = zalloc(sizeof *mc + blocks / 8 + 1 + rrq_len);
+    socket->tftp_pktbuf = malloc(inode->size + socket->tftp_blksize + 5);
+    if (!mc || !socket->tftp_pktbuf)
+	goto fail;
+
+    mc->server  = url->ip;
+    mc->group   = group;
+    mc->blocks  = mc->missing = blocks;
+    mc->lowmiss = 1;
+    mc->master  = master;
+    mc->rxbuf   = socket->tftp_pktbuf + inode->size;
+
+    /* Kept to ask again if the group goes quiet */
+    mc->server_port = url->port;
+    mc->rrq_len = rrq_len;
+    mc->rrq = (char *)mc->have + blocks / 8 + 1;
+    memcpy(mc->rrq, rrq, rrq_len);
+
+    if (core_udp_open(&mc->sock))
+	goto fail;
+    if (core_udp_join(&mc->sock, group, port)) {
+	core_udp_close(&mc->sock);
+	goto fail;
+    }
+
+    socket->tftp_mcast = mc;
+    socket->tftp_lastpkt = 0;
+    socket->ops = &tftp_mcast_conn_ops;
+
+    /* The master ACKs the OACK to have the server start */
+    if (master)
+	tftp_mcast_ack(inode);
+
+    return 0;
+
+fail:
+    free(mc);
+    free(socket->tftp_pktbuf);
+    socket->tftp_pktbuf = NULL;
+    return -1;
+}
+
+/*
+ * The block size to ask for: the largest that fits in one frame on a
+ * link with jumbo frames, TFTP_LARGE_BLOCKSIZE otherwise.
+ */
+static uint16_t tftp_want_blksize(void)
+{
+    unsigned int mtu = net_mtu();
+
+    if (mtu <= TFTP_ETHER_MTU)
+	return TFTP_LARGE_BLOCKSIZE;
+
+    return min(mtu - TFTP_HEADERS_LEN, TFTP_MAX_BLOCKSIZE);
+}
+
 /**
  * Open a TFTP connection to the server
  *
  * @param:inode, the inode to store our state in
  * @param:ip, the ip to contact to get the file
  * @param:filename, the file we wanna open
+ * @param:mcast, ask for the file to be sent to a multicast group
  *
  * @out: open_file_t structure, stores in file->open_file
  * @out: the lenght of this file, stores in file->file_len
  *
  */
-void tftp_open(struct url_info *url, int flags, struct inode *inode,
-	       const char **redir)
+static void __tftp_open(struct url_info *url, int flags, struct inode *inode,
+			bool mcast)
 {
     struct pxe_pvt_inode *socket = PVT(inode);
     char *buf;
@@ -191,8 +585,9 @@ void tftp_open(struct url_info *url, int flags, struct inode *inode,
     char *p;
     char *options;
     char *data;
-    static const char rrq_tail[] = "octet\0""tsize\0""0\0""blksize\0""1408";
-    char rrq_packet_buf[2+2*FILENAME_MAX+sizeof rrq_tail];
+    static const char rrq_tail[] = "octet\0""tsize\0""0\0""blksize";
+    char rrq_packet_buf[2+2*FILENAME_MAX+sizeof rrq_tail+
+			sizeof "65535\0""windowsize\0""65535"];
     char reply_packet_buf[PKTBUF_SIZE];
     int err;
     int buffersize;
@@ -202,11 +597,15 @@ void tftp_open(struct url_info *url, int flags, struct inode *inode,
     jiffies_t oldtime;
     uint16_t opcode;
     uint16_t blk_num;
+    uint16_t blksize;
     uint64_t opdata;
     uint16_t src_port;
     uint32_t src_ip;
+    bool mc_ok;
+    bool mc_master;
+    uint32_t mc_group;
+    uint16_t mc_port;
 
-    (void)redir;		/* TFTP does not redirect */
     (void)flags;
 
     if (url->type != URL_OLD_TFTP) {
@@ -220,6 +619,9 @@ void tftp_open(struct url_info *url, int flags, struct inode *inode,
     if (!url->port)
 	url->port = TFTP_PORT;
 
+    blksize = tftp_want_blksize();
+
+reopen:
     socket->ops = &tftp_conn_ops;
     if (core_udp_open(socket))
 	return;
@@ -233,6 +635,15 @@ void tftp_open(struct url_info *url, int flags, struct inode *inode,
     buf++;			/* Point *past* the final NULL */
     memcpy(buf, rrq_tail, sizeof rrq_tail);
     buf += sizeof rrq_tail;
+    buf += sprintf(buf, "%u", blksize) + 1;
+    if (mcast) {
+	/* The server picks the group; RFC 2090 has no windows */
+	buf = stpcpy(buf, "multicast") + 1;
+	*buf++ = '\0';
+    } else {
+	buf = stpcpy(buf, "windowsize") + 1;
+	buf += sprintf(buf, "%u", TFTP_WINDOWSIZE) + 1;
+    }
 
     rrq_len = buf - rrq_packet_buf;
 
@@ -280,6 +691,10 @@ wait_pkt:
     /* filesize <- -1 == unknown */
     inode->size = -1;
     socket->tftp_blksize = TFTP_BLOCKSIZE;
+    socket->tftp_windowsize = 1;
+    mc_ok = mc_master = false;
+    mc_group = 0;
+    mc_port = 0;
     buffersize = buf_len - 2;	  /* bytes after opcode */
 
     /*
@@ -314,8 +729,7 @@ wait_pkt:
         if (buffersize > TFTP_BLOCKSIZE)
             goto err_reply;	/* Corrupt */
 
-	socket->tftp_pktbuf = malloc(TFTP_BLOCKSIZE + 4);
-	if (!socket->tftp_pktbuf)
+	if (tftp_alloc_pktbuf(socket))
 	    goto err_reply;	/* Internal error */
 
         if (buffersize < TFTP_BLOCKSIZE) {
@@ -373,6 +787,19 @@ wait_pkt:
 	    if (!buffersize)
 		break;		/* No option data */
 
+	    if (mcast && !strcmp(opt, "multicast")) {
+		size_t len = strnlen(p, buffersize);
+
+		if (len == (size_t)buffersize)
+		    break;	/* Unterminated option */
+		if (tftp_mcast_option(p, &mc_group, &mc_port, &mc_master))
+		    goto err_reply;
+		mc_ok = true;
+		p += len + 1;
+		buffersize -= len + 1;
+		continue;
+	    }
+
 	    opdata = 0;
 
             /* do convert a number-string to decimal number, just like atoi */
@@ -390,6 +817,8 @@ wait_pkt:
 		inode->size = opdata;
 	    else if (!strcmp(opt, "blksize"))
 		socket->tftp_blksize = opdata;
+	    else if (!strcmp(opt, "windowsize"))
+		socket->tftp_windowsize = opdata;
 	    else
 		goto err_reply; /* Non-negotitated option returned,
 				   no idea what it means ...*/
@@ -397,12 +826,27 @@ wait_pkt:
 
 	}
 
-	if (socket->tftp_blksize < 64 || socket->tftp_blksize > PKTBUF_SIZE)
+	if (socket->tftp_blksize < 64 || socket->tftp_blksize > blksize)
+	    goto err_reply;
+
+	if (!socket->tftp_windowsize ||
+	    socket->tftp_windowsize > TFTP_WINDOWSIZE)
 	    goto err_reply;
 
+	if (mc_ok) {
+	    if (!tftp_mcast_start(inode, url, rrq_packet_buf, rrq_len,
+				  mc_group, mc_port, mc_master))
+		goto done;
+
+	    /* We can't follow the group; ask again for a unicast transfer */
+	    tftp_error(inode, TFTP_EOPTNEG, "Multicast not possible");
+	    core_udp_close(socket);
+	    mcast = false;
+	    goto reopen;
+	}
+
 	/* Parsing successful, allocate buffer */
-	socket->tftp_pktbuf = malloc(socket->tftp_blksize + 4);
-	if (!socket->tftp_pktbuf)
+	if (tftp_alloc_pktbuf(socket))
 	    goto err_reply;
 	else
 	    goto done;
@@ -424,6 +868,26 @@ done:
     return;
 }
 
+void tftp_open(struct url_info *url, int flags, struct inode *inode,
+	       const char **redir)
+{
+    (void)redir;		/* TFTP does not redirect */
+
+    __tftp_open(url, flags, inode, false);
+}
+
+/*
+ * Open a file over multicast TFTP (RFC 2090), falling back to unicast
+ * if the server or the network stack can't do it.
+ */
+void mtftp_open(struct url_info *url, int flags, struct inode *inode,
+		const char **redir)
+{
+    (void)redir;		/* TFTP does not redirect */
+
+    __tftp_open(url, flags, inode, true);
+}
+
 
 /**
  * Send a file to a TFTP  server
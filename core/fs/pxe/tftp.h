@@ -28,6 +28,23 @@
 #define TFTP_BLOCKSIZE_LG2 9
 #define TFTP_BLOCKSIZE  (1 << TFTP_BLOCKSIZE_LG2)
 
+/*
+ * TFTP block size we ask for (RFC 2348).  On a standard Ethernet this
+ * leaves room for the headers of tunnels and VLANs; on a link with
+ * jumbo frames we ask for as much as fits in one frame, up to the
+ * largest jumbo frame in common use.
+ */
+#define TFTP_LARGE_BLOCKSIZE	1408
+#define TFTP_ETHER_MTU		1500
+#define TFTP_HEADERS_LEN	(20 + 8 + 4)	/* IP + UDP + TFTP */
+#define TFTP_MAX_BLOCKSIZE	(9216 - TFTP_HEADERS_LEN)
+
+/*
+ * TFTP window size we ask for (RFC 7440): the server sends this many
+ * packets before waiting for an ACK.
+ */
+#define TFTP_WINDOWSIZE	16
+
 /*
  * TFTP operation codes
  */
@@ -471,7 +471,7 @@ static int ufs_fs_init(struct fs_info *fs)
 
 const struct fs_ops ufs_fs_ops = {
     .fs_name        = "ufs",
-    .fs_flags       = FS_USEMEM | FS_THISIND,
+    .fs_flags       = FS_USEMEM | FS_THISIND | FS_SEEKABLE,
     .fs_init        = ufs_fs_init,
     .searchdir      = NULL,
     .getfssec       = generic_getfssec,
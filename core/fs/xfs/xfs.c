@@ -17,6 +17,7 @@
 
 #include <dprintf.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/dirent.h>
 #include <cache.h>
@@ -91,24 +92,204 @@ static uint32_t xfs_getfssec(struct file *file, char *buf, int sectors,
     return generic_getfssec(file, buf, sectors, have_more);
 }
 
+/*
+ * Index of the last key not greater than off, or of the first key if
+ * they all are.  Keys are in ascending file offset order.
+ */
+static int xfs_bmbt_key_search(const xfs_bmbt_key_t *kp, int nrecs,
+			       xfs_fileoff_t off)
+{
+    int lo = 0, hi = nrecs, mid;
+
+    while (hi - lo > 1) {
+	mid = (lo + hi) >> 1;
+	if (be64_to_cpu(kp[mid].br_startoff) <= off)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+
+    return lo;
+}
+
+static const xfs_btree_block_t *xfs_bmbt_get_block(struct fs_info *fs,
+						   xfs_fsblock_t fsbno,
+						   int level)
+{
+    const xfs_btree_block_t *blk;
+
+    blk = get_cache(fs->fs_dev, fsblock_to_bytes(fs, fsbno) >> BLOCK_SHIFT(fs));
+    if (!xfs_bmbt_block_len(blk) || be16_to_cpu(blk->bb_level) != level) {
+	xfs_error("Bad bmap btree block 0x%llx", fsbno);
+	return NULL;
+    }
+
+    return blk;
+}
+
+/*
+ * Decode all records of a bmap btree leaf into the inode, so that the
+ * extents it maps can be looked up without touching the disk again.
+ */
+static int xfs_bmbt_load_leaf(struct inode *inode, xfs_fsblock_t fsbno)
+{
+    struct fs_info *fs = inode->fs;
+    struct xfs_inode *xi = XFS_PVT(inode);
+    const xfs_btree_block_t *blk;
+    const xfs_bmbt_rec_t *rp;
+    int maxrecs, nrecs, i;
+
+    blk = xfs_bmbt_get_block(fs, fsbno, 0);
+    if (!blk)
+	return -1;
+
+    maxrecs = (XFS_INFO(fs)->blocksize - xfs_bmbt_block_len(blk)) /
+	sizeof(xfs_bmbt_rec_t);
+    nrecs = be16_to_cpu(blk->bb_numrecs);
+    if (!nrecs || nrecs > maxrecs) {
+	xfs_error("Bad bmap btree leaf 0x%llx", fsbno);
+	return -1;
+    }
+
+    if (!xi->i_bmbt_recs) {
+	xi->i_bmbt_recs = malloc(maxrecs * sizeof(xfs_bmbt_irec_t));
+	if (!xi->i_bmbt_recs) {
+	    malloc_error("xfs_bmbt_irec_t array");
+	    return -1;
+	}
+    }
+
+    rp = (const xfs_bmbt_rec_t *)((const char *)blk + xfs_bmbt_block_len(blk));
+    for (i = 0; i < nrecs; i++)
+	bmbt_irec_get(&xi->i_bmbt_recs[i], rp + i);
+
+    xi->i_bmbt_nrecs = nrecs;
+    xi->i_bmbt_next = be64_to_cpu(blk->bb_u.l.bb_rightsib);
+
+    return 0;
+}
+
+/*
+ * Make the cached leaf the one mapping file block off.  A file read
+ * front to back only ever moves on to the right sibling; anything else
+ * walks down from the root in the inode, one block per level.
+ */
+static int xfs_bmbt_find_leaf(struct inode *inode, xfs_dinode_t *core,
+			      xfs_fileoff_t off)
+{
+    struct fs_info *fs = inode->fs;
+    struct xfs_inode *xi = XFS_PVT(inode);
+    const xfs_bmbt_irec_t *last;
+    const xfs_bmdr_block_t *rblock;
+    const xfs_btree_block_t *blk;
+    const xfs_bmbt_key_t *kp;
+    const xfs_bmbt_ptr_t *pp;
+    xfs_fsblock_t fsbno;
+    int level, nrecs, maxrecs, hdrlen;
+    bool next = false;
+
+    while (xi->i_bmbt_nrecs && off >= xi->i_bmbt_recs[0].br_startoff) {
+	last = &xi->i_bmbt_recs[xi->i_bmbt_nrecs - 1];
+	if (off < last->br_startoff + last->br_blockcount ||
+	    xi->i_bmbt_next == NULLFSBLOCK)
+	    return 0;
+	if (next)
+	    break;
+	if (xfs_bmbt_load_leaf(inode, xi->i_bmbt_next))
+	    return -1;
+	next = true;
+    }
+
+    rblock = XFS_DFORK_PTR(core, XFS_DATA_FORK);
+    maxrecs = xfs_bmdr_maxrecs(XFS_DFORK_SIZE(core, fs, XFS_DATA_FORK), 0);
+    level = be16_to_cpu(rblock->bb_level);
+    nrecs = be16_to_cpu(rblock->bb_numrecs);
+    kp = XFS_BMDR_KEY_ADDR(rblock, 1);
+    pp = XFS_BMDR_PTR_ADDR(rblock, 1, maxrecs);
+
+    while (level--) {
+	if (!nrecs || nrecs > maxrecs)
+	    goto bad;
+
+	fsbno = be64_to_cpu(pp[xfs_bmbt_key_search(kp, nrecs, off)]);
+	if (!level)
+	    return xfs_bmbt_load_leaf(inode, fsbno);
+
+	blk = xfs_bmbt_get_block(fs, fsbno, level);
+	if (!blk)
+	    return -1;
+
+	hdrlen = xfs_bmbt_block_len(blk);
+	maxrecs = (XFS_INFO(fs)->blocksize - hdrlen) /
+	    (sizeof(xfs_bmbt_key_t) + sizeof(xfs_bmbt_ptr_t));
+	nrecs = be16_to_cpu(blk->bb_numrecs);
+	kp = (const xfs_bmbt_key_t *)((const char *)blk + hdrlen);
+	pp = (const xfs_bmbt_ptr_t *)(kp + maxrecs);
+    }
+
+bad:
+    xfs_error("Bad bmap btree root (ino 0x%llx)", inode->ino);
+    return -1;
+}
+
+/*
+ * Index of the last extent starting at or before file block off, or -1
+ * if off lies before the first one.
+ */
+static int xfs_bmap_search(const xfs_bmbt_rec_t *rp, int nrecs,
+			   xfs_fileoff_t off, xfs_bmbt_irec_t *rec)
+{
+    int lo = -1, hi = nrecs, mid;
+
+    while (hi - lo > 1) {
+	mid = (lo + hi) >> 1;
+	bmbt_irec_get(rec, rp + mid);
+	if (rec->br_startoff <= off)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+
+    if (lo >= 0)
+	bmbt_irec_get(rec, rp + lo);
+
+    return lo;
+}
+
+static int xfs_bmap_irec_search(const xfs_bmbt_irec_t *recs, int nrecs,
+				xfs_fileoff_t off)
+{
+    int lo = -1, hi = nrecs, mid;
+
+    while (hi - lo > 1) {
+	mid = (lo + hi) >> 1;
+	if (recs[mid].br_startoff <= off)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+
+    return lo;
+}
+
 static int xfs_next_extent(struct inode *inode, uint32_t lstart)
 {
     struct fs_info *fs = inode->fs;
+    struct xfs_inode *xi = XFS_PVT(inode);
+    const int shift = BLOCK_SHIFT(fs) - SECTOR_SHIFT(fs);
     xfs_dinode_t *core = NULL;
-    xfs_bmbt_irec_t rec;
-    block_t bno;
-    xfs_bmdr_block_t *rblock;
-    int fsize;
-    xfs_bmbt_ptr_t *pp;
-    xfs_btree_block_t *blk;
-    uint16_t nextents;
-    block_t nextbno;
-    uint32_t index;
-
-    (void)lstart;
+    const xfs_bmbt_irec_t *rec = NULL;
+    xfs_bmbt_irec_t irec;
+    xfs_fileoff_t off, end;
+    const xfs_bmbt_rec_t *rp;
+    int nrecs, i;
+    uint64_t pstart;
 
     xfs_debug("inode %p lstart %lu", inode, lstart);
 
+    off = lstart >> shift;
+    end = (inode->size + XFS_INFO(fs)->blocksize - 1) >> BLOCK_SHIFT(fs);
+
     core = xfs_dinode_get_core(fs, inode->ino);
     if (!core) {
 	xfs_error("Failed to get dinode from disk (ino %llx)", inode->ino);
@@ -116,67 +297,61 @@ static int xfs_next_extent(struct inode *inode, uint32_t lstart)
     }
 
     /* The data fork contains the file's data extents */
-    if (XFS_PVT(inode)->i_cur_extent == be32_to_cpu(core->di_nextents))
-        goto out;
-
     if (core->di_format == XFS_DINODE_FMT_EXTENTS) {
-	bmbt_irec_get(&rec, (xfs_bmbt_rec_t *)XFS_DFORK_PTR(core,
-							    XFS_DATA_FORK) +
-						XFS_PVT(inode)->i_cur_extent);
-	XFS_PVT(inode)->i_cur_extent++;
+	rp = XFS_DFORK_PTR(core, XFS_DATA_FORK);
+	nrecs = be32_to_cpu(core->di_nextents);
+	i = xfs_bmap_search(rp, nrecs, off, &irec);
+	if (i >= 0)
+	    rec = &irec;
+	if (i + 1 < nrecs) {
+	    bmbt_irec_get(&irec, rp + i + 1);
+	    end = irec.br_startoff;
+	    if (i >= 0)
+		bmbt_irec_get(&irec, rp + i);
+	}
+    } else if (core->di_format == XFS_DINODE_FMT_BTREE) {
+	if (xfs_bmbt_find_leaf(inode, core, off))
+	    goto out;
+
+	i = xfs_bmap_irec_search(xi->i_bmbt_recs, xi->i_bmbt_nrecs, off);
+	if (i >= 0)
+	    rec = &xi->i_bmbt_recs[i];
+
+	if (i + 1 < xi->i_bmbt_nrecs)
+	    end = xi->i_bmbt_recs[i + 1].br_startoff;
+	else if (off >= rec->br_startoff + rec->br_blockcount &&
+		 xi->i_bmbt_next != NULLFSBLOCK) {
+	    /* A hole running up to the next leaf */
+	    if (xfs_bmbt_load_leaf(inode, xi->i_bmbt_next))
+		goto out;
+	    end = xi->i_bmbt_recs[0].br_startoff;
+	    rec = NULL;
+	}
+    } else {
+	goto out;
+    }
 
-	bno = fsblock_to_bytes(fs, rec.br_startblock) >> BLOCK_SHIFT(fs);
+    if (rec && off < rec->br_startoff + rec->br_blockcount) {
+	end = rec->br_startoff + rec->br_blockcount;
+	if (rec->br_state == XFS_EXT_UNWRITTEN) {
+	    pstart = EXTENT_ZERO;
+	} else {
+	    pstart = (fsblock_to_bytes(fs, rec->br_startblock) +
+		      ((off - rec->br_startoff) << BLOCK_SHIFT(fs))) >>
+		SECTOR_SHIFT(fs);
+	}
+    } else {
+	/* A hole, up to the next extent or the end of the file */
+	pstart = EXTENT_ZERO;
+    }
 
-	XFS_PVT(inode)->i_offset = rec.br_startoff;
+    if (end <= off)
+	goto out;
+    if (end - off > MAXEXTLEN)
+	end = off + MAXEXTLEN;
 
-	inode->next_extent.pstart = bno << BLOCK_SHIFT(fs) >> SECTOR_SHIFT(fs);
-	inode->next_extent.len = ((rec.br_blockcount << BLOCK_SHIFT(fs)) +
-				  SECTOR_SIZE(fs) - 1) >> SECTOR_SHIFT(fs);
-    } else if (core->di_format == XFS_DINODE_FMT_BTREE) {
-        xfs_debug("XFS_DINODE_FMT_BTREE");
-        index = XFS_PVT(inode)->i_cur_extent++;
-        rblock = XFS_DFORK_PTR(core, XFS_DATA_FORK);
-        fsize = XFS_DFORK_SIZE(core, fs, XFS_DATA_FORK);
-        pp = XFS_BMDR_PTR_ADDR(rblock, 1, xfs_bmdr_maxrecs(fsize, 0));
-        bno = fsblock_to_bytes(fs, be64_to_cpu(pp[0])) >> BLOCK_SHIFT(fs);
-
-        /* Find the leaf */
-        for (;;) {
-            blk = (xfs_btree_block_t *)get_cache(fs->fs_dev, bno);
-            if (be16_to_cpu(blk->bb_level) == 0)
-                break;
-
-            pp = XFS_BMBT_PTR_ADDR(fs, blk, 1,
-                    xfs_bmdr_maxrecs(XFS_INFO(fs)->blocksize, 0));
-            bno = fsblock_to_bytes(fs, be64_to_cpu(pp[0])) >> BLOCK_SHIFT(fs);
-        }
-
-        /* Find the right extent among threaded leaves */
-        for (;;) {
-            nextbno = be64_to_cpu(blk->bb_u.l.bb_rightsib);
-            nextents = be16_to_cpu(blk->bb_numrecs);
-            if (nextents - index > 0) {
-                bmbt_irec_get(&rec, XFS_BMDR_REC_ADDR(blk, index + 1));
-
-                bno = fsblock_to_bytes(fs, rec.br_startblock)
-						>> BLOCK_SHIFT(fs);
-
-                XFS_PVT(inode)->i_offset = rec.br_startoff;
-
-                inode->next_extent.pstart = bno << BLOCK_SHIFT(fs)
-                                                >> SECTOR_SHIFT(fs);
-                inode->next_extent.len = ((rec.br_blockcount
-                                            << BLOCK_SHIFT(fs))
-                                            + SECTOR_SIZE(fs) - 1)
-                                            >> SECTOR_SHIFT(fs);
-                break;
-            }
-
-            index -= nextents;
-            bno = fsblock_to_bytes(fs, nextbno) >> BLOCK_SHIFT(fs);
-            blk = (xfs_btree_block_t *)get_cache(fs->fs_dev, bno);
-        }
-    }
+    inode->next_extent.pstart = pstart;
+    inode->next_extent.len = (end - off) << shift;
 
     return 0;
 
@@ -184,6 +359,11 @@ out:
     return -1;
 }
 
+static void xfs_free_inode(struct inode *inode)
+{
+    free(XFS_PVT(inode)->i_bmbt_recs);
+}
+
 static inline struct inode *xfs_fmt_local_find_entry(const char *dname,
 						     struct inode *parent,
 						     xfs_dinode_t *core)
@@ -241,10 +421,7 @@ static struct inode *xfs_iget(const char *dname, struct inode *parent)
 	goto out;
     }
 
-    if (inode->mode == DT_REG) {
-	XFS_PVT(inode)->i_offset = 0;
-	XFS_PVT(inode)->i_cur_extent = 0;
-    } else if (inode->mode == DT_DIR) {
+    if (inode->mode == DT_DIR) {
 	XFS_PVT(inode)->i_btree_offset = 0;
 	XFS_PVT(inode)->i_leaf_ent_offset = 0;
     }
@@ -288,6 +465,10 @@ static int xfs_readlink(struct inode *inode, char *buf)
 	bmbt_irec_get(&rec, XFS_DFORK_PTR(core, XFS_DATA_FORK));
 	db = fsblock_to_bytes(fs, rec.br_startblock) >> BLOCK_SHIFT(fs);
 	dir_buf = xfs_dir2_dirblks_get_cached(fs, db, rec.br_blockcount);
+	if (!dir_buf) {
+	    pathlen = -1;
+	    goto out;
+	}
 
         /*
          * Syslinux only supports filesystem block size larger than or equal to
@@ -418,7 +599,7 @@ out:
 
 const struct fs_ops xfs_fs_ops = {
     .fs_name		= "xfs",
-    .fs_flags		= FS_USEMEM | FS_THISIND,
+    .fs_flags		= FS_USEMEM | FS_THISIND | FS_SEEKABLE,
     .fs_init		= xfs_fs_init,
     .iget_root		= xfs_iget_root,
     .searchdir		= NULL,
@@ -429,6 +610,7 @@ const struct fs_ops xfs_fs_ops = {
     .readdir		= xfs_readdir,
     .iget		= xfs_iget,
     .next_extent	= xfs_next_extent,
+    .free_inode		= xfs_free_inode,
     .readlink		= xfs_readlink,
     .fs_uuid            = NULL,
 };
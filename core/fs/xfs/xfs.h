@@ -413,10 +413,12 @@ struct xfs_inode {
     xfs_agblock_t 	i_agblock;
     block_t		i_ino_blk;
     uint64_t		i_block_offset;
-    uint64_t		i_offset;
-    uint32_t		i_cur_extent;
     uint32_t		i_btree_offset;
     uint16_t		i_leaf_ent_offset;
+    /* Data fork bmap btree: the decoded records of the last leaf read */
+    xfs_bmbt_irec_t	*i_bmbt_recs;
+    uint16_t		i_bmbt_nrecs;
+    xfs_fsblock_t	i_bmbt_next;	/* Right sibling, or NULLFSBLOCK */
 };
 
 typedef struct { uint8_t i[8]; } __attribute__((__packed__)) xfs_dir2_ino8_t;
@@ -772,6 +774,10 @@ typedef struct xfs_btree_block {
 
 #define XFS_BTREE_SBLOCK_LEN 16 /* size of a short form block */
 #define XFS_BTREE_LBLOCK_LEN 24 /* size of a long form block */
+#define XFS_BTREE_LBLOCK_CRC_LEN 72 /* size of a long form v5 block */
+
+#define XFS_BMAP_MAGIC		0x424d4150	/* 'BMAP' */
+#define XFS_BMAP_CRC_MAGIC	0x424d4133	/* 'BMA3' */
 
 /*
  * Bmap root header, on-disk form only.
@@ -836,6 +842,22 @@ typedef uint64_t xfs_bmbt_ptr_t, xfs_bmdr_ptr_t;
                  (maxrecs) * sizeof(xfs_bmdr_key_t) + \
                  ((index) - 1) * sizeof(xfs_bmdr_ptr_t)))
 
+/*
+ * Header size of a bmap btree block, or 0 if it is not one.  v5 blocks
+ * carry a CRC, owner and UUID on top of the v4 header.
+ */
+static inline int xfs_bmbt_block_len(const xfs_btree_block_t *blk)
+{
+    switch (be32_to_cpu(blk->bb_magic)) {
+    case XFS_BMAP_MAGIC:
+	return XFS_BTREE_LBLOCK_LEN;
+    case XFS_BMAP_CRC_MAGIC:
+	return XFS_BTREE_LBLOCK_CRC_LEN;
+    default:
+	return 0;
+    }
+}
+
 /*
  * Calculate number of records in a bmap btree inode root.
  */
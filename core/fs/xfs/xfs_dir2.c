@@ -28,16 +28,34 @@
 
 #include "xfs_dir2.h"
 
-#define XFS_DIR2_DIRBLKS_CACHE_SIZE 128
+/*
+ * Directory blocks larger than a filesystem block, or several of them
+ * read as one, are copied out of the block cache into a separate cache
+ * of their own.  It is bounded both in entries and in bytes, recycles
+ * the least recently used areas first, and is looked up by hashing the
+ * start block.
+ *
+ * Callers hold on to up to three areas at a time (node, leaf and data
+ * block), so the last few areas handed out are never recycled.
+ */
+#define XFS_DIR2_DIRBLKS_CACHE_SIZE	64
+#define XFS_DIR2_DIRBLKS_CACHE_HASH	32	/* Power of 2 */
+#define XFS_DIR2_DIRBLKS_CACHE_BYTES	(512 << 10)
+#define XFS_DIR2_DIRBLKS_CACHE_KEEP	4
 
 struct xfs_dir2_dirblks_cache {
     block_t        dc_startblock;
     xfs_filblks_t  dc_blkscount;
-    void          *dc_area;
+    void          *dc_area;		/* NULL if the entry is unused */
+    size_t         dc_size;
+    uint32_t       dc_stamp;		/* Last use, for LRU replacement */
+    struct xfs_dir2_dirblks_cache *dc_hnext;
 };
 
 static struct xfs_dir2_dirblks_cache dirblks_cache[XFS_DIR2_DIRBLKS_CACHE_SIZE];
-static unsigned char                 dirblks_cached_count = 0;
+static struct xfs_dir2_dirblks_cache *dirblks_hash[XFS_DIR2_DIRBLKS_CACHE_HASH];
+static size_t   dirblks_cached_bytes;
+static uint32_t dirblks_clock;
 
 uint32_t xfs_dir2_da_hashname(const uint8_t *name, int namelen)
 {
@@ -67,17 +85,17 @@ uint32_t xfs_dir2_da_hashname(const uint8_t *name, int namelen)
 }
 
 static void *get_dirblks(struct fs_info *fs, block_t startblock,
-                         xfs_filblks_t c)
+                         size_t len)
 {
-    const size_t len = c * XFS_INFO(fs)->dirblksize;
     uint64_t offs = startblock << BLOCK_SHIFT(fs);
     void *buf;
     size_t ret;
 
     buf = malloc(len);
-    if (!buf)
-        malloc_error("buffer memory");
-    memset(buf, 0, len);
+    if (!buf) {
+        xfs_error("no memory for directory blocks\n");
+        return NULL;
+    }
 
     ret = cache_read(fs, buf, offs, len);
     if (ret != len) {
@@ -88,88 +106,115 @@ static void *get_dirblks(struct fs_info *fs, block_t startblock,
     return buf;
 }
 
-void *xfs_dir2_dirblks_get_cached(struct fs_info *fs, block_t startblock,
-				  xfs_filblks_t c)
+static inline struct xfs_dir2_dirblks_cache **dirblks_bucket(block_t block)
 {
-    unsigned char i;
-    void *buf;
-
-    xfs_debug("fs %p startblock %llu (0x%llx) blkscount %lu", fs, startblock,
-	      startblock, c);
+    return &dirblks_hash[(uint32_t)block & (XFS_DIR2_DIRBLKS_CACHE_HASH - 1)];
+}
 
-    if (!dirblks_cached_count) {
-	buf = get_dirblks(fs, startblock, c);
-	if (!buf)
-	    return NULL;
+static void dirblks_drop(struct xfs_dir2_dirblks_cache *dc)
+{
+    struct xfs_dir2_dirblks_cache **pp = dirblks_bucket(dc->dc_startblock);
 
-	dirblks_cache[dirblks_cached_count].dc_startblock = startblock;
-	dirblks_cache[dirblks_cached_count].dc_blkscount = c;
-	dirblks_cache[dirblks_cached_count].dc_area = buf;
+    while (*pp != dc)
+	pp = &(*pp)->dc_hnext;
+    *pp = dc->dc_hnext;
 
-	return dirblks_cache[dirblks_cached_count++].dc_area;
-    } else if (dirblks_cached_count == XFS_DIR2_DIRBLKS_CACHE_SIZE) {
-	for (i = 0; i < XFS_DIR2_DIRBLKS_CACHE_SIZE / 2; i++) {
-	    unsigned char k = XFS_DIR2_DIRBLKS_CACHE_SIZE - (i + 1);
+    free(dc->dc_area);
+    dirblks_cached_bytes -= dc->dc_size;
+    memset(dc, 0, sizeof *dc);
+}
 
-	    free(dirblks_cache[i].dc_area);
-	    dirblks_cache[i] = dirblks_cache[k];
-	    memset(&dirblks_cache[k], 0, sizeof(dirblks_cache[k]));
+/*
+ * Find an entry for an area of len bytes, recycling old areas until it
+ * fits within the size limit.  Returns NULL if nothing can be recycled.
+ */
+static struct xfs_dir2_dirblks_cache *dirblks_alloc(size_t len)
+{
+    struct xfs_dir2_dirblks_cache *dc, *free_dc, *victim;
+
+    for (;;) {
+	free_dc = victim = NULL;
+	for (dc = dirblks_cache;
+	     dc < &dirblks_cache[XFS_DIR2_DIRBLKS_CACHE_SIZE]; dc++) {
+	    if (!dc->dc_area) {
+		if (!free_dc)
+		    free_dc = dc;
+	    } else if (dirblks_clock - dc->dc_stamp >=
+		       XFS_DIR2_DIRBLKS_CACHE_KEEP &&
+		       (!victim || dc->dc_stamp < victim->dc_stamp)) {
+		victim = dc;
+	    }
 	}
 
-	buf = get_dirblks(fs, startblock, c);
-	if (!buf)
-	    return NULL;
+	if (free_dc &&
+	    dirblks_cached_bytes + len <= XFS_DIR2_DIRBLKS_CACHE_BYTES)
+	    return free_dc;
+	if (!victim)
+	    return free_dc;	/* Over the limit, but callers need it */
 
-	dirblks_cache[XFS_DIR2_DIRBLKS_CACHE_SIZE / 2].dc_startblock =
-	    startblock;
-	dirblks_cache[XFS_DIR2_DIRBLKS_CACHE_SIZE / 2].dc_blkscount = c;
-	dirblks_cache[XFS_DIR2_DIRBLKS_CACHE_SIZE / 2].dc_area = buf;
+	dirblks_drop(victim);
+    }
+}
 
-	dirblks_cached_count = XFS_DIR2_DIRBLKS_CACHE_SIZE / 2;
+/*
+ * Return c directory blocks starting at startblock.  The area stays
+ * valid at least until XFS_DIR2_DIRBLKS_CACHE_KEEP more areas have been
+ * asked for.  A directory block that is exactly one filesystem block is
+ * returned straight from the block cache, without copying.
+ */
+void *xfs_dir2_dirblks_get_cached(struct fs_info *fs, block_t startblock,
+				  xfs_filblks_t c)
+{
+    const size_t len = c * XFS_INFO(fs)->dirblksize;
+    struct xfs_dir2_dirblks_cache *dc;
+    void *buf;
 
-	return dirblks_cache[dirblks_cached_count++].dc_area;
-    } else {
-	block_t block;
-	xfs_filblks_t count;
+    xfs_debug("fs %p startblock %llu (0x%llx) blkscount %lu", fs, startblock,
+	      startblock, c);
 
-	block = dirblks_cache[dirblks_cached_count - 1].dc_startblock;
-	count = dirblks_cache[dirblks_cached_count - 1].dc_blkscount;
+    if (len == BLOCK_SIZE(fs))
+	return (void *)get_cache(fs->fs_dev, startblock);
 
-	if (block == startblock && count == c) {
-	    return dirblks_cache[dirblks_cached_count - 1].dc_area;
-	} else {
-	    for (i = 0; i < dirblks_cached_count; i++) {
-		block = dirblks_cache[i].dc_startblock;
-		count = dirblks_cache[i].dc_blkscount;
+    dirblks_clock++;
 
-		if (block == startblock && count == c)
-		    return dirblks_cache[i].dc_area;
-	    }
+    for (dc = *dirblks_bucket(startblock); dc; dc = dc->dc_hnext) {
+	if (dc->dc_startblock == startblock && dc->dc_blkscount == c) {
+	    dc->dc_stamp = dirblks_clock;
+	    return dc->dc_area;
+	}
+    }
 
-	    buf = get_dirblks(fs, startblock, c);
-	    if (!buf)
-		return NULL;
+    dc = dirblks_alloc(len);
+    if (!dc) {
+	xfs_error("directory block cache is full\n");
+	return NULL;
+    }
 
-	    dirblks_cache[dirblks_cached_count].dc_startblock = startblock;
-	    dirblks_cache[dirblks_cached_count].dc_blkscount = c;
-	    dirblks_cache[dirblks_cached_count].dc_area = buf;
+    buf = get_dirblks(fs, startblock, len);
+    if (!buf)
+	return NULL;
 
-	    return dirblks_cache[dirblks_cached_count++].dc_area;
-	}
-    }
-    return NULL;
+    dc->dc_startblock = startblock;
+    dc->dc_blkscount = c;
+    dc->dc_area = buf;
+    dc->dc_size = len;
+    dc->dc_stamp = dirblks_clock;
+    dc->dc_hnext = *dirblks_bucket(startblock);
+    *dirblks_bucket(startblock) = dc;
+    dirblks_cached_bytes += len;
+
+    return buf;
 }
 
 void xfs_dir2_dirblks_flush_cache(void)
 {
-    unsigned char i;
+    struct xfs_dir2_dirblks_cache *dc;
 
-    for (i = 0; i < dirblks_cached_count; i++) {
-	free(dirblks_cache[i].dc_area);
-	memset(&dirblks_cache[i], 0, sizeof(dirblks_cache[i]));
+    for (dc = dirblks_cache;
+	 dc < &dirblks_cache[XFS_DIR2_DIRBLKS_CACHE_SIZE]; dc++) {
+	if (dc->dc_area)
+	    dirblks_drop(dc);
     }
-
-    dirblks_cached_count = 0;
 }
 
 struct inode *xfs_dir2_local_find_entry(const char *dname, struct inode *parent,
@@ -456,6 +501,9 @@ struct inode *xfs_dir2_leaf_find_entry(const char *dname, struct inode *parent,
 		      BLOCK_SHIFT(parent->fs);
             buf = xfs_dir2_dirblks_get_cached(parent->fs, dir_blk,
 					      irec.br_blockcount);
+            if (!buf)
+                goto out;
+
             data_hdr = (xfs_dir2_data_hdr_t *)buf;
             if (be32_to_cpu(data_hdr->magic) != XFS_DIR2_DATA_MAGIC &&
 		be32_to_cpu(data_hdr->magic) != XFS_DIR3_DATA_MAGIC) {
@@ -662,6 +710,9 @@ struct inode *xfs_dir2_node_find_entry(const char *dname, struct inode *parent,
     }
 
     nhdr = xfs_dir2_dirblks_get_cached(parent->fs, fsblkno, 1);
+    if (!nhdr)
+        goto out;
+
     if (be16_to_cpu(nhdr->info.magic) == XFS_DA_NODE_MAGIC) {
 	count = be16_to_cpu(nhdr->count);
 	btree = (xfs_da_node_entry_t *)((uint8_t *)nhdr +
@@ -699,6 +750,9 @@ struct inode *xfs_dir2_node_find_entry(const char *dname, struct inode *parent,
     }
 
     lhdr = xfs_dir2_dirblks_get_cached(parent->fs, fsblkno, 1);
+    if (!lhdr)
+	goto out;
+
     if (be16_to_cpu(lhdr->info.magic) == XFS_DIR2_LEAFN_MAGIC) {
 	count = be16_to_cpu(lhdr->count);
 	ents = (xfs_dir2_leaf_entry_t *)((uint8_t *)lhdr +
@@ -754,6 +808,9 @@ struct inode *xfs_dir2_node_find_entry(const char *dname, struct inode *parent,
             }
 
             buf = xfs_dir2_dirblks_get_cached(parent->fs, fsblkno, 1);
+            if (!buf)
+                goto out;
+
             data_hdr = (xfs_dir2_data_hdr_t *)buf;
             if (be32_to_cpu(data_hdr->magic) != XFS_DIR2_DATA_MAGIC &&
 		be32_to_cpu(data_hdr->magic) != XFS_DIR3_DATA_MAGIC) {
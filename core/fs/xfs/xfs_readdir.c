@@ -148,6 +148,9 @@ int xfs_readdir_dir2_block(struct file *file, struct dirent *dirent,
     dir_blk = fsblock_to_bytes(fs, r.br_startblock) >> BLOCK_SHIFT(fs);
 
     dirblk_buf = xfs_dir2_dirblks_get_cached(fs, dir_blk, r.br_blockcount);
+    if (!dirblk_buf)
+	goto out;
+
     hdr = (xfs_dir2_data_hdr_t *)dirblk_buf;
     if (be32_to_cpu(hdr->magic) == XFS_DIR2_BLOCK_MAGIC) {
 	isdir3 = false;
@@ -267,6 +270,9 @@ int xfs_readdir_dir2_leaf(struct file *file, struct dirent *dirent,
     dir_blk = fsblock_to_bytes(fs, irec.br_startblock) >> BLOCK_SHIFT(fs);
 
     buf = xfs_dir2_dirblks_get_cached(fs, dir_blk, irec.br_blockcount);
+    if (!buf)
+	goto out;
+
     data_hdr = (xfs_dir2_data_hdr_t *)buf;
     if (be32_to_cpu(data_hdr->magic) != XFS_DIR2_DATA_MAGIC &&
 	be32_to_cpu(data_hdr->magic) != XFS_DIR3_DATA_MAGIC) {
@@ -329,6 +335,9 @@ int xfs_readdir_dir2_node(struct file *file, struct dirent *dirent,
     }
 
     nhdr = xfs_dir2_dirblks_get_cached(fs, fsblkno, 1);
+    if (!nhdr)
+	goto out;
+
     if (be16_to_cpu(nhdr->info.magic) == XFS_DA_NODE_MAGIC) {
 	btcount = be16_to_cpu(nhdr->count);
 	btree = (xfs_da_node_entry_t *)((uint8_t *)nhdr +
@@ -356,6 +365,9 @@ try_next_btree:
     }
 
     lhdr = xfs_dir2_dirblks_get_cached(fs, fsblkno, 1);
+    if (!lhdr)
+	goto out;
+
     if (be16_to_cpu(lhdr->info.magic) == XFS_DIR2_LEAFN_MAGIC) {
 	lfcount = be16_to_cpu(lhdr->count);
 	ents = (xfs_dir2_leaf_entry_t *)((uint8_t *)lhdr +
@@ -402,6 +414,9 @@ try_next_btree:
     }
 
     buf = xfs_dir2_dirblks_get_cached(fs, fsblkno, 1);
+    if (!buf)
+	goto out;
+
     data_hdr = (xfs_dir2_data_hdr_t *)buf;
     if (be32_to_cpu(data_hdr->magic) != XFS_DIR2_DATA_MAGIC &&
 	be32_to_cpu(data_hdr->magic) != XFS_DIR3_DATA_MAGIC) {
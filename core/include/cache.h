@@ -5,6 +5,7 @@
 #include <com32.h>
 #include "disk.h"
 #include "fs.h"
+#include <syslinux/cache.h>
 
 /* The cache structure */
 struct cache {
@@ -14,11 +15,22 @@ struct cache {
     void *data;
 };
 
+/*
+ * Extra cache memory added by cache_grow(); the header sits between
+ * the data blocks and the block descriptors.
+ */
+struct cache_arena {
+    struct cache_arena *next;
+    uint32_t size;		/* Total size of this arena in bytes */
+    uint32_t entries;		/* Number of blocks in this arena */
+};
+
 /* functions defined in cache.c */
 void cache_init(struct device *, int);
 const void *get_cache(struct device *, block_t);
 struct cache *_get_cache_block(struct device *, block_t);
 void cache_lock_block(struct cache *);
 size_t cache_read(struct fs_info *, void *, uint64_t, size_t);
+int cache_grow(struct device *, uint32_t);
 
 #endif /* cache.h */
@@ -35,4 +35,11 @@ static inline int isspace(int ch)
     return space;
 }
 
+static inline int isxdigit(int ch)
+{
+    return (ch >= '0' && ch <= '9') ||
+	(ch >= 'a' && ch <= 'f') ||
+	(ch >= 'A' && ch <= 'F');
+}
+
 #endif /* CTYPE_H */
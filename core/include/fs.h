@@ -8,6 +8,7 @@
 #include <com32.h>
 #include <stdio.h>
 #include <sys/dirent.h>
+#include <sys/uio.h>
 #include <dprintf.h>
 #include "core.h"
 #include "disk.h"
@@ -46,6 +47,7 @@ enum fs_flags {
     FS_NODEV   = 1 << 0,
     FS_USEMEM  = 1 << 1,        /* If we need a malloc routine, set it */
     FS_THISIND = 1 << 2,        /* Set cwd based on config file location */
+    FS_SEEKABLE = 1 << 3,       /* getfssec honours any file->offset */
 };
 
 struct fs_ops {
@@ -65,6 +67,7 @@ struct fs_ops {
 
     struct inode * (*iget_root)(struct fs_info *);
     struct inode * (*iget)(const char *, struct inode *);
+    void     (*free_inode)(struct inode *);	/* Release private data */
     int	     (*readlink)(struct inode *, char *);
 
     /* the _dir_ stuff */
@@ -94,6 +97,17 @@ struct extent {
 
 #define EXTENT_SPECIAL(x)	((x) >= EXTENT_VOID)
 
+/*
+ * Extent map: the coalesced extents of a file from logical sector 0
+ * up to lend, built by generic_getfssec() as the file is read.
+ */
+struct extent_map {
+    uint32_t count;		/* Number of extents in use */
+    uint32_t alloc;		/* Number of extents allocated */
+    uint32_t lend;		/* First logical sector not mapped */
+    struct extent ext[0];
+};
+
 /* 
  * The inode structure, including the detail file information 
  */
@@ -112,7 +126,8 @@ struct inode {
     uint32_t     dtime;  /* Delete time */
     uint32_t     flags;
     uint32_t     file_acl;
-    struct extent this_extent, next_extent;
+    struct extent next_extent;  /* Set by fs_ops->next_extent() */
+    struct extent_map *emap; /* Extent map, see getfssec.c */
     char         pvt[0]; /* Private filesystem data */
 };
 
@@ -128,6 +143,7 @@ struct file {
  *     the cache stuff.
  */
 struct cache;
+struct cache_arena;
 
 struct device {
     struct disk *disk;
@@ -136,9 +152,22 @@ struct device {
     uint8_t cache_init; /* cache initialized state */
     char *cache_data;
     struct cache *cache_head;
+    struct cache **cache_hash;	/* Hash index over block numbers */
+    uint8_t cache_hash_shift;	/* 32 - log2(hash index slots) */
     uint16_t cache_block_size;
-    uint16_t cache_entries;
-    uint32_t cache_size;
+    uint32_t cache_entries;
+    uint32_t cache_size;	/* Size of cache_data */
+    struct cache_arena *cache_arenas;	/* Memory added by cache_grow() */
+
+    /* read-ahead state */
+    char *cache_ra_buf;		/* Bounce buffer for read-ahead */
+    block_t cache_ra_next;	/* Block expected after a sequential miss */
+
+    /* cache statistics, see cache_get_stats() */
+    uint32_t cache_hits;
+    uint32_t cache_misses;
+    uint32_t cache_evictions;
+    uint32_t cache_readahead;
 };
 
 /*
@@ -155,6 +184,9 @@ static inline bool not_whitespace(char c)
 struct inode *alloc_inode(struct fs_info *fs, uint32_t ino, size_t data);
 static inline void free_inode(struct inode * inode)
 {
+    if (inode->fs->fs_ops->free_inode)
+	inode->fs->fs_ops->free_inode(inode);
+    free(inode->emap);
     free(inode);
 }
 
@@ -204,6 +236,8 @@ void mangle_name(char *, const char *);
 int searchdir(const char *name, int flags);
 void _close_file(struct file *);
 size_t pmapi_read_file(uint16_t *handle, void *buf, size_t sectors);
+ssize_t pmapi_preadv_file(uint16_t handle, const struct iovec *iov,
+			  int iovcnt, off_t offset);
 int open_file(const char *name, int flags, struct com32_filedata *filedata);
 void pm_open_file(com32sys_t *);
 void close_file(uint16_t handle);
@@ -245,6 +279,10 @@ int generic_open_config(struct com32_filedata *filedata);
 /* close.c */
 void generic_close_file(struct file *file);
 
+/* dcache.c */
+bool dcache_lookup(struct inode *dir, const char *name, struct inode **inode);
+void dcache_insert(struct inode *dir, const char *name, struct inode *inode);
+
 /* getfssec.c */
 uint32_t generic_getfssec(struct file *file, char *buf,
 			  int sectors, bool *have_more);
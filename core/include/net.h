@@ -26,7 +26,11 @@ void core_udp_send(struct pxe_pvt_inode *socket,
 void core_udp_sendto(struct pxe_pvt_inode *socket, const void *data, size_t len,
 		     uint32_t ip, uint16_t port);
 
+int core_udp_join(struct pxe_pvt_inode *socket, uint32_t group, uint16_t port);
+void core_udp_leave(struct pxe_pvt_inode *socket, uint32_t group);
+
 void probe_undi(void);
+unsigned int net_mtu(void);
 void pxe_init_isr(void);
 
 struct inode;
@@ -4,5 +4,6 @@
 #include <syslinux/pmapi.h>
 
 size_t pmapi_read_file(uint16_t *, void *, size_t);
+ssize_t pmapi_preadv_file(uint16_t, const struct iovec *, int, off_t);
 
 #endif /* PMAPI_H */
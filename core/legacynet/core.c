@@ -13,6 +13,7 @@ extern void free_port(uint16_t);
 
 const struct url_scheme url_schemes[] = {
     { "tftp", tftp_open, 0 },
+    { "mtftp", tftp_open, 0 },	/* No multicast here, fetch it by unicast */
     { NULL, NULL, 0 }
 };
 
@@ -201,10 +202,37 @@ void net_core_init(void)
     }
 }
 
+/*
+ * The PXE UDP API has no way to receive multicast.
+ */
+int core_udp_join(struct pxe_pvt_inode *socket, uint32_t group, uint16_t port)
+{
+    (void)socket;
+    (void)group;
+    (void)port;
+
+    return -1;
+}
+
+void core_udp_leave(struct pxe_pvt_inode *socket, uint32_t group)
+{
+    (void)socket;
+    (void)group;
+}
+
 void probe_undi(void)
 {
 }
 
+/*
+ * The PXE UDP API does not tell us, and reads into a PKTBUF_SIZE buffer
+ * anyway.
+ */
+unsigned int net_mtu(void)
+{
+    return 0;
+}
+
 void pxe_init_isr(void)
 {
 }
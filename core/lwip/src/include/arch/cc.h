@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <kaboom.h>
 #include <stdio.h>
+#include <timer.h>
 
 #define BYTE_ORDER LITTLE_ENDIAN
 
@@ -47,4 +48,7 @@ typedef uintptr_t mem_ptr_t;
 #define X32_F	PRIx16
 #define SZT_F	"zu"
 
+/* Only used to spread out IGMP reports; the millisecond timer will do */
+#define LWIP_RAND()	((u32_t)ms_timer())
+
 #endif /* __LWIP_ARCH_CC_H__ */
@@ -11,6 +11,7 @@
 #define LWIP_TCP		1
 #define LWIP_SO_RCVTIMEO	1
 #define LWIP_ICMP		1
+#define LWIP_IGMP		1
 
 #define TCPIP_MBOX_SIZE         	512
 #define TCPIP_THREAD_PRIO		-10
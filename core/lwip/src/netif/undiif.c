@@ -76,6 +76,7 @@
 #include "netif/ppp_oe.h"
 #include "lwip/netifapi.h"
 #include "lwip/tcpip.h"
+#include "lwip/igmp.h"
 #include "../../../fs/pxe/pxe.h"
 
 #include <inttypes.h>
@@ -386,6 +387,65 @@ int snprintf_udp_hdr(char *str, size_t size, char head[],
 }
 #endif /* UNDIIF_ID_FULL_DEBUG */
 
+#if LWIP_IGMP
+/**
+ * Keep the multicast addresses the UNDI driver receives in step with
+ * the IP multicast groups joined.  Several groups can map to the same
+ * hardware address, so each address counts the groups using it.
+ *
+ * @param netif the lwip network interface structure for this undiif
+ * @param group the IP multicast group joined or left
+ * @param action IGMP_ADD_MAC_FILTER or IGMP_DEL_MAC_FILTER
+ * @return ERR_OK, or ERR_MEM if the driver's list is full
+ */
+static err_t
+undi_igmp_mac_filter(struct netif *netif, ip_addr_t *group, u8_t action)
+{
+  static __lowmem t_PXENV_UNDI_GET_MCAST_ADDR get_mcast;
+  static __lowmem t_PXENV_UNDI_SET_MCAST_ADDR set_mcast;
+  static t_PXENV_UNDI_MCAST_ADDRESS mcast_list;
+  static u8_t mcast_refs[MAXNUM_MCADDR];
+  int i, n = mcast_list.MCastAddrCount;
+
+  memset(&get_mcast, 0, sizeof get_mcast);
+  memcpy(&get_mcast.InetAddr, group, sizeof(get_mcast.InetAddr));
+  pxe_call(PXENV_UNDI_GET_MCAST_ADDR, &get_mcast);
+
+  for (i = 0; i < n; i++) {
+    if (!memcmp(mcast_list.McastAddr[i], get_mcast.MediaAddr,
+		netif->hwaddr_len))
+      break;
+  }
+
+  if (action == IGMP_ADD_MAC_FILTER) {
+    if (i < n) {
+      mcast_refs[i]++;
+      return ERR_OK;
+    }
+    if (n == MAXNUM_MCADDR)
+      return ERR_MEM;
+    memcpy(mcast_list.McastAddr[n], get_mcast.MediaAddr,
+	   sizeof(mcast_list.McastAddr[n]));
+    mcast_refs[n] = 1;
+    mcast_list.MCastAddrCount = n + 1;
+  } else {
+    if (i == n || --mcast_refs[i])
+      return ERR_OK;
+    n--;
+    memcpy(mcast_list.McastAddr[i], mcast_list.McastAddr[n],
+	   sizeof(mcast_list.McastAddr[i]));
+    mcast_refs[i] = mcast_refs[n];
+    mcast_list.MCastAddrCount = n;
+  }
+
+  memset(&set_mcast, 0, sizeof set_mcast);
+  set_mcast.R_Mcast_Buf = mcast_list;
+  pxe_call(PXENV_UNDI_SET_MCAST_ADDR, &set_mcast);
+
+  return ERR_OK;
+}
+#endif /* LWIP_IGMP */
+
 /**
  * In this function, the hardware should be initialized.
  * Called from undiif_init().
@@ -435,6 +495,10 @@ low_level_init(struct netif *netif)
   /* don't set NETIF_FLAG_ETHARP if this device is not an ethernet one */
   if (undi_is_ethernet(netif))
     netif->flags |= NETIF_FLAG_ETHARP;
+#if LWIP_IGMP
+  netif->flags |= NETIF_FLAG_IGMP;
+  netif->igmp_mac_filter = undi_igmp_mac_filter;
+#endif
 
   /* Install the interrupt vector */
   pxe_start_isr();
@@ -0,0 +1,7 @@
+/*
+ * The portable LZO1X decoder, lzo1x_decompress_safe(), from the LZO
+ * library used to build prepcore.  The assembly decoder next to it
+ * only decompresses the core image itself on BIOS; this one is used
+ * for LZO compressed file data on every firmware.
+ */
+#include "../../lzo/src/lzo1x_d2.c"
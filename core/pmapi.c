@@ -26,6 +26,7 @@ const struct com32_pmapi pm_api_vector =
 
     .open_file	= open_file,
     .read_file	= pmapi_read_file,
+    .preadv_file = pmapi_preadv_file,
     .close_file	= close_file,
 
     .opendir	= opendir,
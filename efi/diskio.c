@@ -2,12 +2,25 @@
  * Copyright 2011-2014 Intel Corporation - All Rights Reserved
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <fs.h>
 #include <ilog2.h>
 #include <disk.h>
 #include <dprintf.h>
+#include <errno.h>
+#include <minmax.h>
 #include "efi.h"
 
+/*
+ * Largest transfer handed to the driver at once.  The specification
+ * sets no limit, but not every driver copes with huge requests.
+ */
+#define EFI_MAX_TRANSFER	(1 << 20)
+
+/* For buffers which do not meet the driver's IoAlign */
+static char *bounce_buf;
+
 static inline EFI_STATUS read_blocks(EFI_BLOCK_IO *bio, uint32_t id, 
 				     sector_t lba, UINTN bytes, void *buf)
 {
@@ -25,20 +38,58 @@ static int efi_rdwr_sectors(struct disk *disk, void *buf,
 {
 	struct efi_disk_private *priv = (struct efi_disk_private *)disk->private;
 	EFI_BLOCK_IO *bio = priv->bio;
+	UINT32 align = bio->Media->IoAlign;
 	EFI_STATUS status;
-	UINTN bytes = count * disk->sector_size;
-
-	if (is_write)
-		status = write_blocks(bio, disk->disk_number, lba, bytes, buf);
-	else
-		status = read_blocks(bio, disk->disk_number, lba, bytes, buf);
-
-	if (status != EFI_SUCCESS)
-		Print(L"Failed to %s blocks: 0x%x\n",
-			is_write ? L"write" : L"read",
-			status);
-
-	return count << disk->sector_shift;
+	char *ptr = buf;
+	char *tptr;
+	size_t chunk, done = 0;
+	UINTN bytes;
+
+	while (count) {
+		chunk = min(count, (size_t)disk->maxtransfer);
+		bytes = chunk << disk->sector_shift;
+
+		tptr = ptr;
+		if (align > 1 && ((uintptr_t)ptr & (align - 1))) {
+			if (!bounce_buf) {
+				bounce_buf = malloc(EFI_MAX_TRANSFER + align);
+				if (!bounce_buf) {
+					errno = ENOMEM;
+					return done;
+				}
+			}
+			tptr = (char *)(((uintptr_t)bounce_buf + align - 1) &
+					~(uintptr_t)(align - 1));
+			if (is_write)
+				memcpy(tptr, ptr, bytes);
+		}
+
+		if (is_write)
+			status = write_blocks(bio, disk->disk_number, lba,
+					      bytes, tptr);
+		else
+			status = read_blocks(bio, disk->disk_number, lba,
+					     bytes, tptr);
+
+		if (status != EFI_SUCCESS) {
+			Print(L"Failed to %s blocks: 0x%x\n",
+			      is_write ? L"write" : L"read",
+			      status);
+			errno = EIO;
+			return done;
+		}
+
+		if (tptr != ptr && !is_write)
+			memcpy(ptr, tptr, bytes);
+
+		ptr   += bytes;
+		lba   += chunk;
+		count -= chunk;
+		done  += chunk;
+	}
+
+	/* Like the BIOS implementation, return the number of sectors done */
+	return done;
 }
 
 struct disk *efi_disk_init(void *private)
@@ -69,6 +120,8 @@ struct disk *efi_disk_init(void *private)
     disk.rdwr_sectors  = efi_rdwr_sectors;
     disk.sector_shift  = ilog2(disk.sector_size);
 
+    disk.maxtransfer   = EFI_MAX_TRANSFER >> disk.sector_shift;
+
     dprintf("sector_size=%d, disk_number=%d\n", disk.sector_size,
 	    disk.disk_number);
 
@@ -10,6 +10,7 @@
 
 const struct url_scheme url_schemes[] = {
     { "tftp", tftp_open, 0 },
+    { "mtftp", tftp_open, 0 },	/* No multicast here, fetch it by unicast */
     { "http", http_open, O_DIRECTORY },
     { "ftp",  ftp_open,  O_DIRECTORY },
     { NULL, NULL, 0 },
@@ -23,6 +24,23 @@ void net_core_init(void)
     http_bake_cookies();
 }
 
+/**
+ * The MTU of the link, as reported by the Simple Network Protocol, or
+ * 0 if unknown.
+ */
+unsigned int net_mtu(void)
+{
+    EFI_SIMPLE_NETWORK *snp;
+    EFI_STATUS status;
+
+    status = uefi_call_wrapper(BS->HandleProtocol, 3, image_device_handle,
+			       &SimpleNetworkProtocol, (void **)&snp);
+    if (status != EFI_SUCCESS || !snp->Mode)
+	return 0;
+
+    return snp->Mode->MaxPacketSize;
+}
+
 void pxe_init_isr(void) {}
 void gpxe_init(void) {}
 void pxe_idle_init(void) {}
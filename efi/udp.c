@@ -228,6 +228,7 @@ int core_udp_recv(struct pxe_pvt_inode *socket, void *buf, uint16_t *buf_len,
     EFI_STATUS status;
     EFI_UDP4 *udp;
     size_t size;
+    UINT32 i;
     int rv = -1;
     jiffies_t start;
 
@@ -277,10 +278,22 @@ int core_udp_recv(struct pxe_pvt_inode *socket, void *buf, uint16_t *buf_len,
 	efi_udp_has_recv = 1;
 
     rxdata = token.Packet.RxData;
-    frag = &rxdata->FragmentTable[0];
 
-    size = min(frag->FragmentLength, *buf_len);
-    memcpy(buf, frag->FragmentBuffer, size);
+    /*
+     * The driver may hand us the datagram in several fragments; a
+     * datagram that does not fit is dropped, as with lwIP.
+     */
+    size = 0;
+    for (i = 0; i < rxdata->FragmentCount; i++) {
+	frag = &rxdata->FragmentTable[i];
+	if (frag->FragmentLength > *buf_len - size) {
+	    size = 0;
+	    break;
+	}
+	memcpy((char *)buf + size, frag->FragmentBuffer,
+	       frag->FragmentLength);
+	size += frag->FragmentLength;
+    }
     *buf_len = size;
 
     memcpy(src_port, &rxdata->UdpSession.SourcePort, sizeof(*src_port));
@@ -440,3 +453,22 @@ bail:
 out:
     efi_destroy_binding(b, &Udp4ServiceBindingProtocol);
 }
+
+/*
+ * Multicast receive would need udp_reader to join the group; until
+ * then mtftp URLs are fetched by unicast and this is never called.
+ */
+int core_udp_join(struct pxe_pvt_inode *socket, uint32_t group, uint16_t port)
+{
+    (void)socket;
+    (void)group;
+    (void)port;
+
+    return -1;
+}
+
+void core_udp_leave(struct pxe_pvt_inode *socket, uint32_t group)
+{
+    (void)socket;
+    (void)group;
+}
@@ -118,6 +118,7 @@ LIBENTRY_OBJS = \
 	sys/argv.o sys/sleep.o						\
 	sys/fileinfo.o sys/opendev.o sys/read.o sys/write.o sys/ftell.o \
 	sys/close.o sys/open.o sys/fileread.o sys/fileclose.o		\
+	sys/pread.o							\
 	sys/openmem.o					\
 	sys/isatty.o sys/fstat.o					\
 	\
@@ -202,6 +203,8 @@ CORELIBOBJS = \
 	libgcc/__muldi3.o libgcc/__udivmoddi4.o libgcc/__umoddi3.o	\
 	libgcc/__divdi3.o libgcc/__moddi3.o				\
 	syslinux/debug.o						\
+	zlib/adler32.o zlib/crc32.o zlib/zutil.o zlib/inflate.o		\
+	zlib/inftrees.o zlib/inffast.o					\
 	$(LIBENTRY_OBJS) \
 	$(LIBMODULE_OBJS)
 